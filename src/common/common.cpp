@@ -3,10 +3,35 @@
 #include <cstdarg>
 #include <cstdio>
 
+static thread_local std::string* s_capture = nullptr; // per thread, so a background compile's errors don't race a capture
+
 void custom_printf(const char* format, ...)
 {
     va_list argptr;
     va_start(argptr, format);
-    vfprintf(stdout, format, argptr);
+    if (s_capture != nullptr)
+    {
+        va_list sizeArgs;
+        va_copy(sizeArgs, argptr);
+        const int length = vsnprintf(nullptr, 0, format, sizeArgs);
+        va_end(sizeArgs);
+
+        if (length > 0)
+        {
+            const size_t offset = s_capture->size();
+            s_capture->resize(offset + length + 1);
+            vsnprintf(&(*s_capture)[offset], length + 1, format, argptr);
+            s_capture->resize(offset + length);
+        }
+    }
+    else
+    {
+        vfprintf(stdout, format, argptr);
+    }
     va_end(argptr);
 }
+
+void set_printf_capture(std::string* capture)
+{
+    s_capture = capture;
+}
@@ -4,9 +4,13 @@
 #define CSL_COMMON_H
 
 #include <cassert>
+#include <string>
 
 void custom_printf(const char* format, ...);
 
+// while capture is set, custom_printf on this thread appends to it instead of writing to stdout. For checks and tools
+void set_printf_capture(std::string* capture);
+
 #define PRINTF(...) custom_printf(__VA_ARGS__);
 
 #endif // !COMMON_H
\ No newline at end of file
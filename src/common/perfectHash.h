@@ -0,0 +1,202 @@
+#pragma once
+//
+// Perfect hash tables for fixed key sets: every lookup is one hash and one slot compare.
+// StaticTable is built at compile time, Table is built once at load time
+// with hash and displace (each bucket of keys gets its own seed).
+//
+
+#ifndef COMMON_PERFECT_HASH_H
+#define COMMON_PERFECT_HASH_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace perfectHash
+{
+    // FNV-1a with the seed mixed in, plus a finalizer so low bits are usable as the slot
+    constexpr unsigned int hash(std::string_view key, unsigned int seed)
+    {
+        unsigned int h = 2166136261u ^ (seed * 0x9E3779B9u);
+        for (const char c : key)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        return h;
+    }
+
+    template<typename Value>
+    struct Slot
+    {
+        std::string_view key;
+        Value value{};
+        bool used = false;
+    };
+
+    // compile time table. Fails to compile if no seed spreads the keys without collisions
+    template<typename Value, size_t N>
+    class StaticTable
+    {
+    private:
+        static constexpr size_t s_capacity = std::bit_ceil(N * 4);
+
+        std::array<Slot<Value>, s_capacity> slots{};
+        unsigned int seed = 0;
+
+        constexpr bool tryBuild(const std::pair<std::string_view, Value>(&entries)[N], unsigned int trySeed)
+        {
+            slots = {};
+            for (const std::pair<std::string_view, Value>& entry : entries)
+            {
+                Slot<Value>& slot = slots[hash(entry.first, trySeed) & (s_capacity - 1)];
+                if (slot.used)
+                {
+                    return false;
+                }
+
+                slot.key = entry.first;
+                slot.value = entry.second;
+                slot.used = true;
+            }
+
+            seed = trySeed;
+            return true;
+        }
+
+    public:
+        constexpr StaticTable(const std::pair<std::string_view, Value>(&entries)[N])
+        {
+            for (unsigned int trySeed = 0; trySeed < 4096; ++trySeed)
+            {
+                if (tryBuild(entries, trySeed))
+                {
+                    return;
+                }
+            }
+
+            throw "perfectHash::StaticTable: no seed found, keys are probably duplicated";
+        }
+
+        constexpr const Value* find(std::string_view key) const
+        {
+            const Slot<Value>& slot = slots[hash(key, seed) & (s_capacity - 1)];
+            return slot.used && slot.key == key ? &slot.value : nullptr;
+        }
+    };
+
+    // load time table. Keys are not copied, they have to outlive the table and be unique
+    template<typename Value>
+    class Table
+    {
+    private:
+        std::vector<unsigned int> bucketSeeds;
+        std::vector<Slot<Value>> slots;
+
+        bool tryBuild(const std::vector<std::pair<std::string_view, Value>>& entries, size_t capacity)
+        {
+            const size_t bucketCount = std::max<size_t>(entries.size() / 2, 1);
+            bucketSeeds.assign(bucketCount, 0);
+            slots.assign(capacity, Slot<Value>());
+
+            std::vector<std::vector<size_t>> buckets(bucketCount);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                buckets[hash(entries[i].first, 0) % bucketCount].push_back(i);
+            }
+
+            // biggest buckets first, while the table is still empty
+            std::vector<size_t> order(bucketCount);
+            for (size_t i = 0; i < bucketCount; ++i)
+            {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+            std::vector<size_t> placed;
+            for (const size_t bucket : order)
+            {
+                if (buckets[bucket].empty())
+                {
+                    break;
+                }
+
+                bool found = false;
+                for (unsigned int seed = 1; seed < 65536 && found == false; ++seed)
+                {
+                    placed.clear();
+                    found = true;
+                    for (const size_t entry : buckets[bucket])
+                    {
+                        const size_t slot = hash(entries[entry].first, seed) & (capacity - 1);
+                        if (slots[slot].used || std::find(placed.begin(), placed.end(), slot) != placed.end())
+                        {
+                            found = false;
+                            break;
+                        }
+                        placed.push_back(slot);
+                    }
+
+                    if (found)
+                    {
+                        bucketSeeds[bucket] = seed;
+                        for (size_t i = 0; i < placed.size(); ++i)
+                        {
+                            const std::pair<std::string_view, Value>& entry = entries[buckets[bucket][i]];
+                            slots[placed[i]].key = entry.first;
+                            slots[placed[i]].value = entry.second;
+                            slots[placed[i]].used = true;
+                        }
+                    }
+                }
+
+                if (found == false)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+    public:
+        void build(const std::vector<std::pair<std::string_view, Value>>& entries)
+        {
+            size_t capacity = std::bit_ceil(std::max<size_t>(entries.size() * 2, 1));
+            while (tryBuild(entries, capacity) == false)
+            {
+                capacity *= 2;
+            }
+        }
+
+        void clear()
+        {
+            bucketSeeds.clear();
+            slots.clear();
+        }
+
+        const Value* find(std::string_view key) const
+        {
+            if (slots.empty())
+            {
+                return nullptr;
+            }
+
+            const unsigned int seed = bucketSeeds[hash(key, 0) % bucketSeeds.size()];
+            const Slot<Value>& slot = slots[hash(key, seed) & (slots.size() - 1)];
+            return slot.used && slot.key == key ? &slot.value : nullptr;
+        }
+
+        size_t getMemoryBytes() const { return bucketSeeds.capacity() * sizeof(unsigned int) + slots.capacity() * sizeof(Slot<Value>); }
+    };
+}
+
+#endif
\ No newline at end of file
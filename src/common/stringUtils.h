@@ -7,6 +7,7 @@
 #ifndef COMMON_STRING_UTILS_H
 #define COMMON_STRING_UTILS_H
 
+#include <charconv>
 #include <vector>
 #include <string>
 
@@ -63,6 +64,23 @@ namespace stringUtils
         return s;
     }
 
+    // whole string has to be a number, no leading/trailing junk
+    inline bool toNumber(const std::string& s, double& outNumber)
+    {
+        const char* begin = s.data();
+        const char* end = begin + s.size();
+        std::from_chars_result result = std::from_chars(begin, end, outNumber);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+
+    // shortest text that reads back as the same number
+    inline void fromNumber(double number, std::string& outString)
+    {
+        char buffer[32];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+        outString.assign(buffer, result.ptr);
+    }
+
     inline void split(const std::string& line, const char splitter, std::vector<std::string>& splitString)
     {
         size_t begin = 0;
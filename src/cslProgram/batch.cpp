@@ -0,0 +1,370 @@
+#include "batch.h"
+
+#include "common/common.h"
+#include "common/stringUtils.h"
+#include "program.h"
+
+#include <algorithm>
+#include <bit>
+#include <unordered_set>
+
+namespace cslProgram
+{
+	#pragma region BatchColumns
+
+	double* BatchColumns::AddColumn(const std::string& name, double initialValue)
+	{
+		std::unordered_map<std::string, std::vector<double>>::iterator iter = columns.find(name);
+		if (iter == columns.end())
+		{
+			iter = columns.insert({ name, std::vector<double>(rowCount, initialValue) }).first;
+		}
+		return iter->second.data();
+	}
+
+	double* BatchColumns::FindColumn(const std::string& name)
+	{
+		std::unordered_map<std::string, std::vector<double>>::iterator iter = columns.find(name);
+		return iter != columns.end() ? iter->second.data() : nullptr;
+	}
+
+	const double* BatchColumns::FindColumn(const std::string& name) const
+	{
+		std::unordered_map<std::string, std::vector<double>>::const_iterator iter = columns.find(name);
+		return iter != columns.end() ? iter->second.data() : nullptr;
+	}
+
+	#pragma endregion
+
+	#pragma region BatchContext
+
+	BatchContext::BatchContext(Program* inProgram, BatchColumns& inColumns, BatchResult& inResult) :
+		program(inProgram),
+		columns(inColumns),
+		result(inResult)
+	{
+		const size_t rowCount = columns.GetRowCount();
+		result.output.assign(rowCount, std::string());
+		result.succeeded.assign(rowCount, 1);
+	}
+
+	double* BatchContext::GetRegisterColumn(unsigned int slot)
+	{
+		if (slot >= registerColumns.size())
+		{
+			registerColumns.resize(slot + 1, nullptr);
+		}
+
+		if (registerColumns[slot] == nullptr)
+		{
+			registerColumns[slot] = columns.AddColumn(program->GetRegisterName(slot), program->GetRegister(slot));
+		}
+		return registerColumns[slot];
+	}
+
+	double* BatchContext::FindVarColumn(const std::string& name)
+	{
+		unsigned int slot;
+		if (NumberRegisters::IsRegisterName(name) && program->FindRegisterSlot(name, slot))
+		{
+			return GetRegisterColumn(slot);
+		}
+
+		return columns.FindColumn(name);
+	}
+
+	double* BatchContext::GetOrAddVarColumn(const std::string& name)
+	{
+		double* column = FindVarColumn(name);
+		if (column != nullptr)
+		{
+			return column;
+		}
+
+		// rows the var isn't set for keep the program's value, as they would running one at a time
+		double initialValue = 0.0;
+		const std::string* value = program->FindValue(name);
+		if (value == nullptr || stringUtils::toNumber(*value, initialValue) == false)
+		{
+			initialValue = 0.0;
+		}
+		return columns.AddColumn(name, initialValue);
+	}
+
+	const double* BatchContext::GetOperandColumn(const std::string& valueOrVarName)
+	{
+		const double* column = FindVarColumn(valueOrVarName);
+		if (column != nullptr)
+		{
+			return column;
+		}
+
+		std::string value = valueOrVarName;
+		program->GetValueFromValueOrName(value);
+
+		double number;
+		if (stringUtils::toNumber(value, number) == false)
+		{
+			return nullptr;
+		}
+
+		return GetConstantColumn(number);
+	}
+
+	const double* BatchContext::GetOperandColumn(const NumericOperand& operand)
+	{
+		if (operand.isRegister)
+		{
+			return GetRegisterColumn(operand.slot);
+		}
+
+		return GetConstantColumn(operand.constant);
+	}
+
+	const double* BatchContext::GetConstantColumn(double value)
+	{
+		std::unordered_map<std::uint64_t, std::vector<double>>::iterator iter = constants.find(std::bit_cast<std::uint64_t>(value));
+		if (iter == constants.end())
+		{
+			iter = constants.insert({ std::bit_cast<std::uint64_t>(value), std::vector<double>(GetRowCount(), value) }).first;
+		}
+		return iter->second.data();
+	}
+
+	BatchFrame& BatchContext::GetFrame(size_t depth)
+	{
+		while (frames.size() <= depth)
+		{
+			BatchFrame& frame = frames.emplace_back();
+			frame.condition.resize(GetRowCount());
+			frame.armMask.resize(GetRowCount());
+		}
+		return frames[depth];
+	}
+
+	void BatchContext::FailRow(size_t row)
+	{
+		result.succeeded[row] = 0;
+		mask[row] = 0;
+	}
+
+	void BatchContext::FailMaskedRows()
+	{
+		for (size_t row = 0; row < GetRowCount(); ++row)
+		{
+			if (mask[row] != 0)
+			{
+				FailRow(row);
+			}
+		}
+	}
+
+	void BatchContext::AppendOutput(size_t row, const std::string& line)
+	{
+		result.output[row] += line;
+		result.output[row] += '\n';
+	}
+
+	#pragma endregion
+
+	#pragma region Program
+
+	// batch columns hold doubles and Print formats them back, so only text fromNumber writes prints the same as a per-row run
+	bool IsBatchNumberText(const std::string& text)
+	{
+		double number;
+		if (stringUtils::toNumber(text, number) == false)
+		{
+			return false;
+		}
+
+		std::string formatted;
+		stringUtils::fromNumber(number, formatted);
+		return formatted == text;
+	}
+
+	bool Program::CanRunBatch(const Function* function, std::unordered_set<const Function*>& checked, std::vector<const Instruction*>& outVarSetters)
+	{
+		checked.insert(function);
+
+		for (const Instruction* instruction : function->instructions)
+		{
+			const std::string* name;
+			const std::string* value;
+			if (instruction->GetVarAssignment(name, value))
+			{
+				outVarSetters.push_back(instruction);
+			}
+
+			const std::string* callTarget = instruction->GetCallTarget();
+			if (callTarget != nullptr)
+			{
+				const Function* callee = FindFunction(*callTarget);
+				if (callee == nullptr || EnsureCompiled(callee) == false)
+				{
+					PRINTF("Batch error: Can't run function %s called in line: %s\n", callTarget->c_str(), GetSrcLine(instruction->GetDebugId()).c_str());
+					return false;
+				}
+
+				if (checked.find(callee) == checked.end() && CanRunBatch(callee, checked, outVarSetters) == false)
+				{
+					return false;
+				}
+			}
+			else if (instruction->SupportsBatch() == false)
+			{
+				PRINTF("Batch error: Instruction can't run in batch mode: %s\n", GetSrcLine(instruction->GetDebugId()).c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool Program::CanSetBatchVars(const std::vector<const Instruction*>& varSetters, const BatchColumns& columns)
+	{
+		// vars set anywhere in the batch become columns, so they can be read before the setter is checked
+		std::unordered_set<std::string> setNames;
+		for (const Instruction* instruction : varSetters)
+		{
+			const std::string* name;
+			const std::string* value;
+			instruction->GetVarAssignment(name, value);
+			setNames.insert(*name);
+		}
+
+		for (const Instruction* instruction : varSetters)
+		{
+			const std::string* name;
+			const std::string* value;
+			instruction->GetVarAssignment(name, value);
+
+			// rows that don't run the SetVar print the program's value from the column
+			const std::string* current = FindValue(*name);
+			if (current != nullptr && columns.FindColumn(*name) == nullptr && IsBatchNumberText(*current) == false)
+			{
+				PRINTF("Batch error: Var %s holds %s, which batch mode can't print the same way, in line: %s\n", name->c_str(), current->c_str(), GetSrcLine(instruction->GetDebugId()).c_str());
+				return false;
+			}
+
+			unsigned int slot;
+			if (columns.FindColumn(*value) != nullptr || setNames.find(*value) != setNames.end() ||
+				(NumberRegisters::IsRegisterName(*value) && FindRegisterSlot(*value, slot)))
+			{
+				continue;
+			}
+
+			std::string resolved = *value;
+			GetValueFromValueOrName(resolved);
+
+			double number;
+			if (stringUtils::toNumber(resolved, number) == false)
+			{
+				PRINTF("Batch error: Batch vars can only be set to numbers, got %s in line: %s\n", value->c_str(), GetSrcLine(instruction->GetDebugId()).c_str());
+				return false;
+			}
+
+			if (IsBatchNumberText(resolved) == false)
+			{
+				std::string formatted;
+				stringUtils::fromNumber(number, formatted);
+				PRINTF("Batch error: %s would print as %s in batch mode, in line: %s\n", resolved.c_str(), formatted.c_str(), GetSrcLine(instruction->GetDebugId()).c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Program::RunBatchInstruction(const Instruction* instruction, BatchContext& context, std::vector<unsigned char>& mask, size_t depth)
+	{
+		const std::string* callTarget = instruction->GetCallTarget();
+		if (callTarget != nullptr)
+		{
+			// the callee only clears rows that failed, which the caller drops from its mask too, so it can share the mask
+			RunBatchInternal(FindFunction(*callTarget), context, mask, depth + 1); // checked by CanRunBatch
+			return;
+		}
+
+		context.mask = mask.data();
+		instruction->ExecuteBatch(context);
+	}
+
+	void Program::RunBatchInternal(const Function* function, BatchContext& context, std::vector<unsigned char>& mask, size_t depth)
+	{
+		const size_t rowCount = context.GetRowCount();
+		BatchFrame& frame = context.GetFrame(depth); // a call in an arm runs its conditionals in the next frame
+		std::vector<unsigned char>& condition = frame.condition;
+		std::vector<unsigned char>& armMask = frame.armMask;
+
+		std::list<const Instruction*>::const_iterator iter = function->instructions.begin();
+		const std::list<const Instruction*>::const_iterator end = function->instructions.end();
+
+		while (iter != end)
+		{
+			// rows that failed stop running, like the single row runner stops at the first failure
+			for (size_t row = 0; row < rowCount; ++row)
+			{
+				mask[row] = context.IsRowFailed(row) ? 0 : mask[row];
+			}
+
+			if (std::find(mask.begin(), mask.end(), 1) == mask.end())
+			{
+				return;
+			}
+
+			const Instruction* instruction = *iter;
+			if (instruction->IsConditional() == false)
+			{
+				RunBatchInstruction(instruction, context, mask, depth);
+				++iter;
+				continue;
+			}
+
+			context.mask = mask.data();
+			context.condition = condition.data();
+			instruction->ExecuteBatch(context);
+
+			// both arms run, each for the rows that would have taken it
+			const Instruction* trueArm = *(++iter);
+			const Instruction* falseArm = *(++iter);
+
+			for (size_t row = 0; row < rowCount; ++row)
+			{
+				armMask[row] = context.IsRowFailed(row) ? 0 : mask[row] & condition[row];
+			}
+			RunBatchInstruction(trueArm, context, armMask, depth);
+
+			for (size_t row = 0; row < rowCount; ++row)
+			{
+				armMask[row] = context.IsRowFailed(row) ? 0 : mask[row] & (condition[row] ^ 1);
+			}
+			RunBatchInstruction(falseArm, context, armMask, depth);
+
+			++iter;
+		}
+	}
+
+	bool Program::RunBatch(const std::string& functionName, BatchColumns& columns, BatchResult& outResult)
+	{
+		const Function* function = FindFunction(functionName);
+		if (function == nullptr || EnsureCompiled(function) == false)
+		{
+			return false;
+		}
+
+		std::unordered_set<const Function*> checked;
+		std::vector<const Instruction*> varSetters;
+		if (CanRunBatch(function, checked, varSetters) == false || CanSetBatchVars(varSetters, columns) == false)
+		{
+			return false;
+		}
+
+		BatchContext context(this, columns, outResult);
+		std::vector<unsigned char> mask(columns.GetRowCount(), 1);
+		RunBatchInternal(function, context, mask, 0);
+		return true;
+	}
+
+	#pragma endregion
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef CSLPROGRAM_BATCH_H
+#define CSLPROGRAM_BATCH_H
+
+#include "instruction.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cslProgram
+{
+	class Program;
+
+	// Columnar input for Program::RunBatch: one contiguous column of numbers per variable, every column GetRowCount() long.
+	// Register columns are named like the register ('#name'). Columns are updated in place by the run
+	class BatchColumns
+	{
+	private:
+		size_t rowCount;
+		std::unordered_map<std::string, std::vector<double>> columns;
+
+	public:
+		explicit BatchColumns(size_t inRowCount) : rowCount(inRowCount) {}
+
+		size_t GetRowCount() const { return rowCount; }
+
+		// returns the existing column if there is one, otherwise adds one filled with initialValue
+		double* AddColumn(const std::string& name, double initialValue = 0.0);
+
+		double* FindColumn(const std::string& name);
+		const double* FindColumn(const std::string& name) const;
+	};
+
+	struct BatchResult
+	{
+		std::vector<std::string> output; // what Print wrote for each row, one '\n' terminated line per Print
+		std::vector<unsigned char> succeeded; // 1 if the function ran to the end for the row
+	};
+
+	// Buffers for running the conditionals of one function, see BatchContext::GetFrame
+	struct BatchFrame
+	{
+		std::vector<unsigned char> condition;
+		std::vector<unsigned char> armMask;
+	};
+
+	// State of one Program::RunBatch. Instructions read and write whole columns,
+	// only touching rows set in mask. Rows that fail are dropped from every later mask
+	class BatchContext
+	{
+	private:
+		Program* program;
+		BatchColumns& columns;
+		BatchResult& result;
+		std::vector<double*> registerColumns; // by register slot, added on first use
+		std::unordered_map<std::uint64_t, std::vector<double>> constants; // by the bits of the value, so every operand is a column
+		std::deque<BatchFrame> frames; // by call depth, reused by every call at that depth
+
+	public:
+		unsigned char* mask = nullptr; // rows the current instruction runs for, 1 or 0
+		unsigned char* condition = nullptr; // written by conditionals, 1 where the condition held
+
+		BatchContext(Program* inProgram, BatchColumns& inColumns, BatchResult& inResult);
+
+		size_t GetRowCount() const { return columns.GetRowCount(); }
+		Program* GetProgram() const { return program; }
+		bool IsRowFailed(size_t row) const { return result.succeeded[row] == 0; }
+
+		// column for a register, starts with the register's current value unless the input had one
+		double* GetRegisterColumn(unsigned int slot);
+
+		// column for var or register name, nullptr if the input has no such column.
+		// Names without a column read the program's value, the same for every row
+		double* FindVarColumn(const std::string& name);
+		double* GetOrAddVarColumn(const std::string& name);
+
+		// column holding the value of valueOrVarName for each row, nullptr if it is not a number
+		const double* GetOperandColumn(const std::string& valueOrVarName);
+		const double* GetOperandColumn(const NumericOperand& operand);
+		const double* GetConstantColumn(double value); // one shared column per distinct value
+
+		BatchFrame& GetFrame(size_t depth);
+
+		void FailRow(size_t row); // also clears the row from mask
+		void FailMaskedRows();
+		void AppendOutput(size_t row, const std::string& line);
+	};
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include "batchKernels.h"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CSL_BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace cslProgram
+{
+	// a where mask is set, b where it isn't
+	inline double SelectRow(unsigned char mask, double a, double b)
+	{
+		const std::uint64_t keep = static_cast<std::uint64_t>(mask) - 1; // all bits set where mask is 0
+		return std::bit_cast<double>((std::bit_cast<std::uint64_t>(a) & ~keep) | (std::bit_cast<std::uint64_t>(b) & keep));
+	}
+
+#ifdef CSL_BATCH_SSE2
+	// 4 mask bytes widened to 2 lanes of 2 rows each, all bits set where the mask is 0
+	inline void KeepLanes(const unsigned char* mask, __m128d& outKeep0, __m128d& outKeep1)
+	{
+		int bytes;
+		memcpy(&bytes, mask, sizeof(bytes));
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rows = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero); // one row per 32 bits
+		outKeep0 = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_unpacklo_epi32(rows, rows), zero));
+		outKeep1 = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_unpackhi_epi32(rows, rows), zero));
+	}
+
+	inline __m128d SelectLanes(__m128d keep, __m128d a, __m128d b)
+	{
+		return _mm_or_pd(_mm_andnot_pd(keep, a), _mm_and_pd(keep, b));
+	}
+
+	template<ECompareOp Op>
+	__m128d CompareLanes(__m128d lhs, __m128d rhs)
+	{
+		if constexpr (Op == ECompareOp::Greater) return _mm_cmpgt_pd(lhs, rhs);
+		else if constexpr (Op == ECompareOp::GreaterEqual) return _mm_cmpge_pd(lhs, rhs);
+		else if constexpr (Op == ECompareOp::Less) return _mm_cmplt_pd(lhs, rhs);
+		else if constexpr (Op == ECompareOp::LessEqual) return _mm_cmple_pd(lhs, rhs);
+		else if constexpr (Op == ECompareOp::Equal) return _mm_cmpeq_pd(lhs, rhs);
+		else return _mm_cmpneq_pd(lhs, rhs);
+	}
+
+	template<ECompareOp Op>
+	__m128 CompareLanes(__m128 lhs, __m128 rhs)
+	{
+		if constexpr (Op == ECompareOp::Greater) return _mm_cmpgt_ps(lhs, rhs);
+		else if constexpr (Op == ECompareOp::GreaterEqual) return _mm_cmpge_ps(lhs, rhs);
+		else if constexpr (Op == ECompareOp::Less) return _mm_cmplt_ps(lhs, rhs);
+		else if constexpr (Op == ECompareOp::LessEqual) return _mm_cmple_ps(lhs, rhs);
+		else if constexpr (Op == ECompareOp::Equal) return _mm_cmpeq_ps(lhs, rhs);
+		else return _mm_cmpneq_ps(lhs, rhs);
+	}
+
+	template<EArithmeticOp Op>
+	__m128d ArithmeticLanes(__m128d lhs, __m128d rhs)
+	{
+		if constexpr (Op == EArithmeticOp::Add) return _mm_add_pd(lhs, rhs);
+		else if constexpr (Op == EArithmeticOp::Sub) return _mm_sub_pd(lhs, rhs);
+		else if constexpr (Op == EArithmeticOp::Mul) return _mm_mul_pd(lhs, rhs);
+		else if constexpr (Op == EArithmeticOp::Div) return _mm_div_pd(lhs, rhs);
+		else if constexpr (Op == EArithmeticOp::Min) return _mm_min_pd(lhs, rhs); // lhs < rhs ? lhs : rhs, like the scalar one
+		else return _mm_max_pd(lhs, rhs); // lhs > rhs ? lhs : rhs
+	}
+#endif
+
+	template<EArithmeticOp Op>
+	double ArithmeticRow(double lVal, double rVal)
+	{
+		if constexpr (Op == EArithmeticOp::Add) return lVal + rVal;
+		else if constexpr (Op == EArithmeticOp::Sub) return lVal - rVal;
+		else if constexpr (Op == EArithmeticOp::Mul) return lVal * rVal;
+		else if constexpr (Op == EArithmeticOp::Div) return lVal / rVal; // masked rows dividing by zero already failed
+		else if constexpr (Op == EArithmeticOp::Min) return lVal < rVal ? lVal : rVal;
+		else return lVal > rVal ? lVal : rVal;
+	}
+
+	template<typename T, ECompareOp Op>
+	void CompareRows(const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount)
+	{
+		size_t row = 0;
+#ifdef CSL_BATCH_SSE2
+		for (; row + 4 <= rowCount; row += 4)
+		{
+			const __m128d lhs0 = _mm_loadu_pd(lhs + row);
+			const __m128d lhs1 = _mm_loadu_pd(lhs + row + 2);
+			const __m128d rhs0 = _mm_loadu_pd(rhs + row);
+			const __m128d rhs1 = _mm_loadu_pd(rhs + row + 2);
+
+			int bits;
+			if constexpr (std::is_same_v<T, float>)
+			{
+				bits = _mm_movemask_ps(CompareLanes<Op>(_mm_movelh_ps(_mm_cvtpd_ps(lhs0), _mm_cvtpd_ps(lhs1)), _mm_movelh_ps(_mm_cvtpd_ps(rhs0), _mm_cvtpd_ps(rhs1))));
+			}
+			else
+			{
+				bits = _mm_movemask_pd(CompareLanes<Op>(lhs0, rhs0)) | (_mm_movemask_pd(CompareLanes<Op>(lhs1, rhs1)) << 2);
+			}
+
+			outCondition[row] = static_cast<unsigned char>(bits & 1);
+			outCondition[row + 1] = static_cast<unsigned char>((bits >> 1) & 1);
+			outCondition[row + 2] = static_cast<unsigned char>((bits >> 2) & 1);
+			outCondition[row + 3] = static_cast<unsigned char>((bits >> 3) & 1);
+		}
+#endif
+		for (; row < rowCount; ++row)
+		{
+			outCondition[row] = static_cast<unsigned char>(Compare(Op, static_cast<T>(lhs[row]), static_cast<T>(rhs[row])));
+		}
+	}
+
+	// T is the precision the scalar instruction compares at
+	template<typename T>
+	void CompareColumnsAt(ECompareOp op, const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount)
+	{
+		switch (op)
+		{
+		case ECompareOp::Greater: CompareRows<T, ECompareOp::Greater>(lhs, rhs, outCondition, rowCount); break;
+		case ECompareOp::GreaterEqual: CompareRows<T, ECompareOp::GreaterEqual>(lhs, rhs, outCondition, rowCount); break;
+		case ECompareOp::Less: CompareRows<T, ECompareOp::Less>(lhs, rhs, outCondition, rowCount); break;
+		case ECompareOp::LessEqual: CompareRows<T, ECompareOp::LessEqual>(lhs, rhs, outCondition, rowCount); break;
+		case ECompareOp::Equal: CompareRows<T, ECompareOp::Equal>(lhs, rhs, outCondition, rowCount); break;
+		case ECompareOp::NotEqual: CompareRows<T, ECompareOp::NotEqual>(lhs, rhs, outCondition, rowCount); break;
+		}
+	}
+
+	void CompareColumns(ECompareOp op, const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount)
+	{
+		CompareColumnsAt<double>(op, lhs, rhs, outCondition, rowCount);
+	}
+
+	void CompareColumnsAsFloat(ECompareOp op, const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount)
+	{
+		CompareColumnsAt<float>(op, lhs, rhs, outCondition, rowCount);
+	}
+
+	template<EArithmeticOp Op>
+	void ArithmeticRows(const double* lhs, const double* rhs, double* dest, const unsigned char* mask, size_t rowCount)
+	{
+		size_t row = 0;
+#ifdef CSL_BATCH_SSE2
+		for (; row + 4 <= rowCount; row += 4)
+		{
+			__m128d keep0, keep1;
+			KeepLanes(mask + row, keep0, keep1);
+
+			// dest can be the lhs or rhs column, read everything before storing
+			const __m128d result0 = ArithmeticLanes<Op>(_mm_loadu_pd(lhs + row), _mm_loadu_pd(rhs + row));
+			const __m128d result1 = ArithmeticLanes<Op>(_mm_loadu_pd(lhs + row + 2), _mm_loadu_pd(rhs + row + 2));
+			const __m128d dest0 = _mm_loadu_pd(dest + row);
+			const __m128d dest1 = _mm_loadu_pd(dest + row + 2);
+			_mm_storeu_pd(dest + row, SelectLanes(keep0, result0, dest0));
+			_mm_storeu_pd(dest + row + 2, SelectLanes(keep1, result1, dest1));
+		}
+#endif
+		for (; row < rowCount; ++row)
+		{
+			dest[row] = SelectRow(mask[row], ArithmeticRow<Op>(lhs[row], rhs[row]), dest[row]);
+		}
+	}
+
+	void ArithmeticColumns(EArithmeticOp op, const double* lhs, const double* rhs, double* dest, const unsigned char* mask, size_t rowCount)
+	{
+		switch (op)
+		{
+		case EArithmeticOp::Add: ArithmeticRows<EArithmeticOp::Add>(lhs, rhs, dest, mask, rowCount); break;
+		case EArithmeticOp::Sub: ArithmeticRows<EArithmeticOp::Sub>(lhs, rhs, dest, mask, rowCount); break;
+		case EArithmeticOp::Mul: ArithmeticRows<EArithmeticOp::Mul>(lhs, rhs, dest, mask, rowCount); break;
+		case EArithmeticOp::Div: ArithmeticRows<EArithmeticOp::Div>(lhs, rhs, dest, mask, rowCount); break;
+		case EArithmeticOp::Min: ArithmeticRows<EArithmeticOp::Min>(lhs, rhs, dest, mask, rowCount); break;
+		case EArithmeticOp::Max: ArithmeticRows<EArithmeticOp::Max>(lhs, rhs, dest, mask, rowCount); break;
+		}
+	}
+
+	void CopyRows(const double* source, double* dest, const unsigned char* mask, size_t rowCount)
+	{
+		size_t row = 0;
+#ifdef CSL_BATCH_SSE2
+		for (; row + 4 <= rowCount; row += 4)
+		{
+			__m128d keep0, keep1;
+			KeepLanes(mask + row, keep0, keep1);
+			_mm_storeu_pd(dest + row, SelectLanes(keep0, _mm_loadu_pd(source + row), _mm_loadu_pd(dest + row)));
+			_mm_storeu_pd(dest + row + 2, SelectLanes(keep1, _mm_loadu_pd(source + row + 2), _mm_loadu_pd(dest + row + 2)));
+		}
+#endif
+		for (; row < rowCount; ++row)
+		{
+			dest[row] = SelectRow(mask[row], source[row], dest[row]);
+		}
+	}
+}
\ No newline at end of file
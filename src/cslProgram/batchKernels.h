@@ -0,0 +1,25 @@
+#pragma once
+
+#ifndef CSLPROGRAM_BATCH_KERNELS_H
+#define CSLPROGRAM_BATCH_KERNELS_H
+
+#include "instruction.h"
+
+namespace cslProgram
+{
+	// Column kernels behind Instruction::ExecuteBatch. They run 4 rows at a time with SSE2 where it's available (always on x64),
+	// the remaining rows and other targets use the same loops without branches in the body. Masked out rows are blended back, not skipped
+
+	// outCondition is 1 where op holds, compared at double precision like NumericCompareConditional
+	void CompareColumns(ECompareOp op, const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount);
+
+	// same as CompareColumns, compared at float precision like CompareConditional
+	void CompareColumnsAsFloat(ECompareOp op, const double* lhs, const double* rhs, unsigned char* outCondition, size_t rowCount);
+
+	// dest can be lhs or rhs. Div doesn't check for zero, rows dividing by zero should already be masked out
+	void ArithmeticColumns(EArithmeticOp op, const double* lhs, const double* rhs, double* dest, const unsigned char* mask, size_t rowCount);
+
+	void CopyRows(const double* source, double* dest, const unsigned char* mask, size_t rowCount);
+}
+
+#endif // CSLPROGRAM_BATCH_KERNELS_H
@@ -0,0 +1,69 @@
+#include "continuation.h"
+
+#include "common/common.h"
+#include "program.h"
+
+#include <utility>
+
+namespace cslProgram
+{
+	Continuation::Continuation(Program* inProgram, Fiber&& inFiber) :
+		program(inProgram),
+		fiber(std::move(inFiber)),
+		resumePoint(fiber.GetHandle()),
+		status(ERunStatus::Preempted) {}
+
+	Continuation::Continuation(Continuation&& other) noexcept :
+		program(std::exchange(other.program, nullptr)),
+		fiber(std::move(other.fiber)),
+		resumePoint(std::exchange(other.resumePoint, nullptr)),
+		status(std::exchange(other.status, ERunStatus::Cancelled)) {}
+
+	Continuation& Continuation::operator=(Continuation&& other) noexcept
+	{
+		if (this != &other)
+		{
+			program = std::exchange(other.program, nullptr);
+			fiber = std::move(other.fiber); // destroys frames we still held
+			resumePoint = std::exchange(other.resumePoint, nullptr);
+			status = std::exchange(other.status, ERunStatus::Cancelled);
+		}
+		return *this;
+	}
+
+	ERunStatus Continuation::Resume(const RunLimits& limits)
+	{
+		if (IsDone())
+		{
+			return status;
+		}
+
+		Continuation* outer = program->m_continuation;
+		program->m_continuation = this;
+		program->BeginLimitedRun(limits);
+
+		resumePoint.resume(); // runs until the function finishes or Program::SuspendFiber updates our status
+
+		program->EndLimitedRun();
+		program->m_continuation = outer;
+
+		if (fiber.IsDone())
+		{
+			status = fiber.GetResult() ? ERunStatus::Finished : ERunStatus::Failed;
+			fiber = Fiber(); // free the frames now, not when the host drops us
+		}
+
+		return status;
+	}
+
+	void Continuation::Cancel()
+	{
+		if (IsDone())
+		{
+			return;
+		}
+
+		fiber = Fiber();
+		status = ERunStatus::Cancelled;
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef CSLPROGRAM_CONTINUATION_H
+#define CSLPROGRAM_CONTINUATION_H
+
+#include "fiber.h"
+
+#include <chrono>
+#include <coroutine>
+
+namespace cslProgram
+{
+	class Program;
+
+	// Limits for one stretch of execution. Checked when a function is entered,
+	// each entry charges that function's instruction count against the budget
+	struct RunLimits
+	{
+		unsigned int instructionBudget = 0; // 0 is unlimited
+		std::chrono::nanoseconds timeLimit = std::chrono::nanoseconds(0); // 0 is unlimited
+	};
+
+	enum ERunStatus
+	{
+		Finished,
+		Failed,
+		NotFound, // function doesn't exist
+		Preempted, // ran out of budget or time, Resume to continue
+		Suspended, // hit Yield or WaitFor, Resume to continue
+		Cancelled
+	};
+
+	// Function run started by Program::RunFunction with RunLimits.
+	// Holds the suspended call frames until it finishes, gets cancelled or is destroyed
+	class Continuation
+	{
+		friend class Program;
+
+	private:
+		Program* program;
+		Fiber fiber;
+		std::coroutine_handle<> resumePoint; // innermost suspended frame
+		ERunStatus status;
+
+		Continuation(Program* inProgram, Fiber&& inFiber);
+
+	public:
+		explicit Continuation(ERunStatus inStatus) : program(nullptr), status(inStatus) {}
+		// the moved from continuation is left Cancelled, with nothing to resume
+		Continuation(Continuation&& other) noexcept;
+		Continuation& operator=(Continuation&& other) noexcept;
+
+		ERunStatus GetStatus() const { return status; }
+		bool IsDone() const { return status != ERunStatus::Preempted && status != ERunStatus::Suspended; }
+
+		// continues from where the run stopped, with a fresh budget
+		ERunStatus Resume(const RunLimits& limits);
+
+		// destroys the suspended frames, the rest of the function never runs
+		void Cancel();
+	};
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "debugInfo.h"
+
+#include <cassert>
+#include <cstdio>
+#include <mutex>
+
+namespace cslProgram
+{
+	unsigned int DebugInfo::Add(const std::string& line, unsigned int lineNumber, unsigned int column)
+	{
+		DebugRecord record;
+		record.line = lineNumber;
+		record.column = static_cast<unsigned short>(column);
+		record.length = static_cast<unsigned short>(line.size());
+
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		record.sourceOffset = static_cast<unsigned int>(source.size());
+
+#ifndef CSL_STRIP_DEBUG_SOURCE
+		source += line;
+		source += '\0';
+#endif
+
+		records.push_back(record);
+		return static_cast<unsigned int>(records.size() - 1);
+	}
+
+	void DebugInfo::Reserve(size_t recordCount, size_t sourceBytes)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		records.reserve(records.size() + recordCount);
+#ifndef CSL_STRIP_DEBUG_SOURCE
+		source.reserve(source.size() + sourceBytes);
+#else
+		(void)sourceBytes;
+#endif
+	}
+
+	std::string DebugInfo::GetSrcLine(unsigned int debugId) const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		assert(debugId < records.size());
+		const DebugRecord& record = records[debugId];
+
+#ifndef CSL_STRIP_DEBUG_SOURCE
+		return std::string(source.c_str() + record.sourceOffset);
+#else
+		char buffer[48];
+		snprintf(buffer, sizeof(buffer), "line %u, column %u", record.line, static_cast<unsigned int>(record.column));
+		return buffer;
+#endif
+	}
+
+	DebugRecord DebugInfo::GetRecord(unsigned int debugId) const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		assert(debugId < records.size());
+		return records[debugId];
+	}
+
+	size_t DebugInfo::GetRecordBytes() const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return records.capacity() * sizeof(DebugRecord);
+	}
+
+	size_t DebugInfo::GetSourceBytes() const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		return source.empty() ? 0 : source.capacity() + 1;
+	}
+}
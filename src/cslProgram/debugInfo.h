@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef CSLPROGRAM_DEBUG_INFO_H
+#define CSLPROGRAM_DEBUG_INFO_H
+
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace cslProgram
+{
+	// where an instruction came from in the source script
+	struct DebugRecord
+	{
+		unsigned int line; // 1 based
+		unsigned short column; // 1 based, first non whitespace char of the line
+		unsigned short length; // of the trimmed line
+		unsigned int sourceOffset; // into DebugInfo::source, unused if source is stripped
+	};
+
+	// Side table of source locations, indexed by Instruction debug id.
+	// Kept out of the instructions so they stay small, only read when printing errors.
+	// Define CSL_STRIP_DEBUG_SOURCE to drop the source text and print line/column instead.
+	// Lazily compiled programs Add from whichever thread compiles while other threads read, so access is locked
+	class DebugInfo
+	{
+	private:
+		mutable std::shared_mutex mutex;
+		std::vector<DebugRecord> records;
+		std::string source; // trimmed source lines, each followed by '\0'
+
+	public:
+		// line should be trimmed. returns debug id to store in the instruction
+		unsigned int Add(const std::string& line, unsigned int lineNumber, unsigned int column);
+
+		// room for this many more records and source bytes, so adding them doesn't regrow the buffers
+		void Reserve(size_t recordCount, size_t sourceBytes);
+
+		// copy of the source text of the instruction, or its location if source was stripped. Only used for errors
+		std::string GetSrcLine(unsigned int debugId) const;
+
+		DebugRecord GetRecord(unsigned int debugId) const;
+		size_t GetRecordBytes() const;
+		size_t GetSourceBytes() const;
+	};
+}
+
+#endif
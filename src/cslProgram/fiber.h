@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef CSLPROGRAM_FIBER_H
+#define CSLPROGRAM_FIBER_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace cslProgram
+{
+	// Coroutine returned by Program when running a function inside a Scheduler.
+	// Each script function call gets its own small heap frame, no thread or native stack.
+	// Fibers start suspended. co_await'ing a fiber from another fiber runs it to completion
+	// (suspending the caller along with it if it yields) and returns whether it succeeded.
+	class Fiber
+	{
+	public:
+		struct promise_type;
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		// resumes whoever co_await'ed this fiber, or returns control to the scheduler for root fibers
+		struct FinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(Handle handle) noexcept
+			{
+				std::coroutine_handle<> continuation = handle.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+
+		struct promise_type
+		{
+			bool result = false;
+			std::coroutine_handle<> continuation; // fiber that called this one, null for root fibers
+
+			Fiber get_return_object() { return Fiber(Handle::from_promise(*this)); }
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			FinalAwaiter final_suspend() const noexcept { return {}; }
+			void return_value(bool inResult) { result = inResult; }
+			void unhandled_exception() { std::terminate(); }
+		};
+
+	private:
+		Handle handle;
+
+	public:
+		Fiber() : handle(nullptr) {}
+		explicit Fiber(Handle inHandle) : handle(inHandle) {}
+		Fiber(Fiber&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+		Fiber(const Fiber&) = delete;
+		Fiber& operator=(const Fiber&) = delete;
+		Fiber& operator=(Fiber&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (handle)
+				{
+					handle.destroy();
+				}
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+		~Fiber()
+		{
+			if (handle)
+			{
+				handle.destroy();
+			}
+		}
+
+		bool IsDone() const { return handle.done(); }
+		bool GetResult() const { return handle.promise().result; }
+		std::coroutine_handle<> GetHandle() const { return handle; }
+
+		// awaitable interface, used for RunFunc inside a fiber
+		bool await_ready() const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+		{
+			handle.promise().continuation = caller;
+			return handle;
+		}
+		bool await_resume() const noexcept { return handle.promise().result; }
+	};
+}
+
+#endif
\ No newline at end of file
@@ -1,12 +1,71 @@
 #include "instruction.h"
 
+#include "batch.h"
+#include "batchKernels.h"
 #include "common/common.h"
+#include "common/stringUtils.h"
 #include "program.h"
 
 #include <cstdio>
 
 namespace cslProgram
 {
+	#pragma region Memory size
+
+	// heap bytes owned by a string, 0 if it fits in the small string buffer
+	size_t StringHeapSize(const std::string& s)
+	{
+		static const size_t s_smallCapacity = std::string().capacity();
+		return s.capacity() > s_smallCapacity ? s.capacity() + 1 : 0;
+	}
+
+	size_t PrintInstruction::GetMemorySize() const
+	{
+		size_t size = sizeof(*this) + line.capacity() * sizeof(std::string);
+		for (const std::string& word : line)
+		{
+			size += StringHeapSize(word);
+		}
+		return size;
+	}
+
+	size_t SetVarInstruction::GetMemorySize() const
+	{
+		return sizeof(*this) + StringHeapSize(name) + StringHeapSize(value);
+	}
+
+	size_t RunFuncInstruction::GetMemorySize() const
+	{
+		return sizeof(*this) + StringHeapSize(name);
+	}
+
+	size_t YieldInstruction::GetMemorySize() const
+	{
+		return sizeof(*this) + StringHeapSize(ticks);
+	}
+
+	size_t WaitForInstruction::GetMemorySize() const
+	{
+		return sizeof(*this) + StringHeapSize(name);
+	}
+
+	size_t NativeCallInstruction::GetMemorySize() const
+	{
+		size_t size = sizeof(*this) + StringHeapSize(resultName) + args.capacity() * sizeof(NativeArg);
+		for (const NativeArg& arg : args)
+		{
+			size += StringHeapSize(arg.word);
+		}
+		return size;
+	}
+
+	size_t CompareConditional::GetMemorySize() const
+	{
+		return sizeof(*this) + StringHeapSize(lVar) + StringHeapSize(rVar);
+	}
+
+	#pragma endregion
+
 	EInstructionResult PrintInstruction::Execute(Program* context) const
 	{
 		std::string totalLine = "";
@@ -31,47 +90,237 @@ namespace cslProgram
 	{
 		if (context->RunFunction(name) == false)
 		{
-			PRINTF("Runtime Error: Run function failed at line: %s\n", srcLine.c_str());
+			PRINTF("Runtime Error: Run function failed at line: %s\n", context->GetSrcLine(debugId).c_str());
 			return EInstructionResult::Fail;
 		}
 		return EInstructionResult::Success;
 	}
 
-	EInstructionResult IsGreaterConditional::Execute(Program* context) const
+	EInstructionResult YieldInstruction::Execute(Program* context) const
 	{
-		float lVal;
-		if (context->GetFloatFromValueOrName(lVar, lVal) == false)
+		float ticksVal;
+		if (context->GetFloatFromValueOrName(ticks, ticksVal) == false || ticksVal < 0.0f)
 		{
-			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", lVar.c_str(), srcLine.c_str());
+			PRINTF("Runtime Error: Failed to get tick count from argument %s in line: %s\n", ticks.c_str(), context->GetSrcLine(debugId).c_str());
 			return EInstructionResult::Fail;
 		}
 
-		float rVal;
-		if (context->GetFloatFromValueOrName(rVar, rVal) == false)
+		context->RequestSuspend(static_cast<unsigned int>(ticksVal), "");
+		return EInstructionResult::Suspend;
+	}
+
+	EInstructionResult WaitForInstruction::Execute(Program* context) const
+	{
+		// a value written before the fiber got here would otherwise be missed, wakes only come from later writes
+		unsigned int slot;
+		if (nextWrite == false && (NumberRegisters::IsRegisterName(name) ? context->FindRegisterSlot(name, slot) : context->FindValue(name) != nullptr))
 		{
-			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", rVar.c_str(), srcLine.c_str());
+			return EInstructionResult::Success;
+		}
+
+		context->RequestSuspend(0, name);
+		return EInstructionResult::Suspend;
+	}
+
+	EInstructionResult NativeCallInstruction::Execute(Program* context) const
+	{
+		NativeValue result;
+		if (function->Call(context, args.data(), result) == false)
+		{
+			PRINTF("Runtime Error: Native call argument is not a number or out of range for its parameter in line: %s\n", context->GetSrcLine(debugId).c_str());
 			return EInstructionResult::Fail;
 		}
 
-		return lVal > rVal ? EInstructionResult::CondTrue : EInstructionResult::CondFalse;
+		if (resultIsRegister)
+		{
+			context->SetRegister(resultSlot, result.ToNumber());
+		}
+		else if (resultName.empty() == false)
+		{
+			std::string text;
+			NativeToString(result, text);
+			context->SetVarValue(resultName, text);
+		}
+
+		return EInstructionResult::Success;
 	}
 
-	EInstructionResult IsGreaterEqualConditional::Execute(Program* context) const
+	EInstructionResult CompareConditional::Execute(Program* context) const
 	{
 		float lVal;
 		if (context->GetFloatFromValueOrName(lVar, lVal) == false)
 		{
-			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", lVar.c_str(), srcLine.c_str());
+			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", lVar.c_str(), context->GetSrcLine(debugId).c_str());
 			return EInstructionResult::Fail;
 		}
 
 		float rVal;
 		if (context->GetFloatFromValueOrName(rVar, rVal) == false)
 		{
-			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", rVar.c_str(), srcLine.c_str());
+			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", rVar.c_str(), context->GetSrcLine(debugId).c_str());
 			return EInstructionResult::Fail;
 		}
 
-		return lVal >= rVal ? EInstructionResult::CondTrue : EInstructionResult::CondFalse;
+		return Compare(op, lVal, rVal) ? EInstructionResult::CondTrue : EInstructionResult::CondFalse;
+	}
+
+	inline double GetOperand(const Program* context, const NumericOperand& operand)
+	{
+		return operand.isRegister ? context->GetRegister(operand.slot) : operand.constant;
+	}
+
+	EInstructionResult NumericCompareConditional::Execute(Program* context) const
+	{
+		return Compare(op, GetOperand(context, lhs), GetOperand(context, rhs)) ? EInstructionResult::CondTrue : EInstructionResult::CondFalse;
+	}
+
+	EInstructionResult ArithmeticInstruction::Execute(Program* context) const
+	{
+		const double lVal = GetOperand(context, lhs);
+		const double rVal = GetOperand(context, rhs);
+
+		double result = 0.0;
+		switch (op)
+		{
+		case EArithmeticOp::Add: result = lVal + rVal; break;
+		case EArithmeticOp::Sub: result = lVal - rVal; break;
+		case EArithmeticOp::Mul: result = lVal * rVal; break;
+		case EArithmeticOp::Div:
+			if (rVal == 0.0)
+			{
+				PRINTF("Runtime Error: Division by zero in line: %s\n", context->GetSrcLine(debugId).c_str());
+				return EInstructionResult::Fail;
+			}
+			result = lVal / rVal;
+			break;
+		case EArithmeticOp::Min: result = lVal < rVal ? lVal : rVal; break;
+		case EArithmeticOp::Max: result = lVal > rVal ? lVal : rVal; break;
+		}
+
+		context->SetRegister(destSlot, result);
+		return EInstructionResult::Success;
+	}
+
+	EInstructionResult SetRegisterInstruction::Execute(Program* context) const
+	{
+		context->SetRegister(destSlot, GetOperand(context, value));
+		return EInstructionResult::Success;
+	}
+
+	#pragma region Batch
+
+	void PrintInstruction::ExecuteBatch(BatchContext& context) const
+	{
+		// words with a column differ per row, the rest are resolved once
+		std::vector<const double*> wordColumns(line.size());
+		std::vector<std::string> wordValues(line.size());
+		for (size_t i = 0; i < line.size(); ++i)
+		{
+			wordColumns[i] = context.FindVarColumn(line[i]);
+			if (wordColumns[i] == nullptr)
+			{
+				wordValues[i] = line[i];
+				context.GetProgram()->GetValueFromValueOrName(wordValues[i]);
+			}
+		}
+
+		std::string totalLine;
+		std::string number;
+		for (size_t row = 0; row < context.GetRowCount(); ++row)
+		{
+			if (context.mask[row] == 0)
+			{
+				continue;
+			}
+
+			totalLine.clear();
+			for (size_t i = 0; i < line.size(); ++i)
+			{
+				if (wordColumns[i] != nullptr)
+				{
+					stringUtils::fromNumber(wordColumns[i][row], number);
+					totalLine += number;
+				}
+				else
+				{
+					totalLine += wordValues[i];
+				}
+			}
+			context.AppendOutput(row, totalLine);
+		}
+	}
+
+	void SetVarInstruction::ExecuteBatch(BatchContext& context) const
+	{
+		const double* source = context.GetOperandColumn(value);
+		if (source == nullptr)
+		{
+			PRINTF("Runtime Error: Batch vars can only be set to numbers, got %s in line: %s\n", value.c_str(), context.GetProgram()->GetSrcLine(debugId).c_str());
+			context.FailMaskedRows();
+			return;
+		}
+
+		CopyRows(source, context.GetOrAddVarColumn(name), context.mask, context.GetRowCount());
+	}
+
+	void CompareConditional::ExecuteBatch(BatchContext& context) const
+	{
+		const double* lhs = context.GetOperandColumn(lVar);
+		if (lhs == nullptr)
+		{
+			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", lVar.c_str(), context.GetProgram()->GetSrcLine(debugId).c_str());
+			context.FailMaskedRows();
+			return;
+		}
+
+		const double* rhs = context.GetOperandColumn(rVar);
+		if (rhs == nullptr)
+		{
+			PRINTF("Runtime Error: Failed to get value from argument %s in line: %s\n", rVar.c_str(), context.GetProgram()->GetSrcLine(debugId).c_str());
+			context.FailMaskedRows();
+			return;
+		}
+
+		CompareColumnsAsFloat(op, lhs, rhs, context.condition, context.GetRowCount());
 	}
+
+	void NumericCompareConditional::ExecuteBatch(BatchContext& context) const
+	{
+		CompareColumns(op, context.GetOperandColumn(lhs), context.GetOperandColumn(rhs), context.condition, context.GetRowCount());
+	}
+
+	void ArithmeticInstruction::ExecuteBatch(BatchContext& context) const
+	{
+		const size_t rowCount = context.GetRowCount();
+		const double* lVals = context.GetOperandColumn(lhs);
+		const double* rVals = context.GetOperandColumn(rhs);
+		double* dest = context.GetRegisterColumn(destSlot);
+
+		if (op == EArithmeticOp::Div)
+		{
+			size_t failedRows = 0;
+			for (size_t row = 0; row < rowCount; ++row)
+			{
+				if (context.mask[row] != 0 && rVals[row] == 0.0)
+				{
+					context.FailRow(row);
+					++failedRows;
+				}
+			}
+
+			if (failedRows > 0)
+			{
+				PRINTF("Runtime Error: Division by zero in %zu rows in line: %s\n", failedRows, context.GetProgram()->GetSrcLine(debugId).c_str());
+			}
+		}
+
+		ArithmeticColumns(op, lVals, rVals, dest, context.mask, rowCount);
+	}
+
+	void SetRegisterInstruction::ExecuteBatch(BatchContext& context) const
+	{
+		CopyRows(context.GetOperandColumn(value), context.GetRegisterColumn(destSlot), context.mask, context.GetRowCount());
+	}
+
+	#pragma endregion
 }
\ No newline at end of file
@@ -3,12 +3,15 @@
 #ifndef CSLPROGRAM_INSTRUCTION_H
 #define CSLPROGRAM_INSTRUCTION_H
 
+#include "native.h"
+
 #include <string>
 #include <vector>
 
 namespace cslProgram
 {
 	class Program;
+	class BatchContext;
 
 	enum EInstructionResult
 	{
@@ -17,19 +20,38 @@ namespace cslProgram
 
 		// returned by conditional instructions
 		CondTrue,
-		CondFalse
+		CondFalse,
+
+		// returned by Yield/WaitFor, runner reads the request from Program::GetSuspendRequest
+		Suspend
 	};
 
 	class Instruction
 	{
 	protected:
-		std::string srcLine; // line from source script that this instruction was created from. Printed for debugging errors
+		unsigned int debugId; // index of this instruction's source location in the program's DebugInfo. Printed for debugging errors
 
 	public:
-		Instruction(const std::string& inSrc) : srcLine(inSrc) {}
+		Instruction(unsigned int inDebugId) : debugId(inDebugId) {}
+		virtual ~Instruction() {}
 		virtual EInstructionResult Execute(Program* context) const = 0;
 		virtual bool IsConditional() const { return false; }
-		const char* GetSrcLine() { return srcLine.c_str(); }
+		virtual const std::string* GetCallTarget() const { return nullptr; } // name of function called by this instruction, if any
+		unsigned int GetDebugId() const { return debugId; }
+
+		// bytes used by this instruction including the strings it owns, for Program::MemoryStats
+		virtual size_t GetMemorySize() const = 0;
+
+		// copy of this instruction, used when inlining function bodies
+		virtual Instruction* Clone() const = 0;
+
+		// Program::RunBatch support. ExecuteBatch runs the instruction for every row set in context.mask,
+		// conditionals write each row's result to context.condition instead of returning it
+		virtual bool SupportsBatch() const { return false; }
+		virtual void ExecuteBatch(BatchContext& context) const { (void)context; } // only called if SupportsBatch
+
+		// var set by this instruction and the value or var name it's set to, if it sets a var. Lets RunBatch check values up front
+		virtual bool GetVarAssignment(const std::string*& outName, const std::string*& outValueOrVarName) const { (void)outName; (void)outValueOrVarName; return false; }
 	};
 
 	class PrintInstruction : public Instruction
@@ -38,11 +60,15 @@ namespace cslProgram
 		std::vector<std::string> line; // parsing should make sure this is not empty
 
 	public:
-		PrintInstruction(const std::string& inSrc, const std::vector<std::string>& inLine) :
-			Instruction(inSrc),
+		PrintInstruction(unsigned int inDebugId, const std::vector<std::string>& inLine) :
+			Instruction(inDebugId),
 			line(inLine) {}
 
 		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new PrintInstruction(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
 	};
 
 	class SetVarInstruction : public Instruction
@@ -53,12 +79,23 @@ namespace cslProgram
 		std::string value;
 
 	public:
-		SetVarInstruction(const std::string& inSrc, const std::string& inName, const std::string& inValue) :
-			Instruction(inSrc),
+		SetVarInstruction(unsigned int inDebugId, const std::string& inName, const std::string& inValue) :
+			Instruction(inDebugId),
 			name(inName),
 			value(inValue) {}
 
 		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new SetVarInstruction(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
+
+		virtual bool GetVarAssignment(const std::string*& outName, const std::string*& outValueOrVarName) const override
+		{
+			outName = &name;
+			outValueOrVarName = &value;
+			return true;
+		}
 	};
 
 	class RunFuncInstruction : public Instruction
@@ -67,48 +104,215 @@ namespace cslProgram
 		std::string name; // parsing should make sure this is not empty and is one word
 
 	public:
-		RunFuncInstruction(const std::string& inSrc, const std::string& inName) :
-			Instruction(inSrc),
+		RunFuncInstruction(unsigned int inDebugId, const std::string& inName) :
+			Instruction(inDebugId),
 			name(inName) {}
 
 		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new RunFuncInstruction(*this); }
+		virtual const std::string* GetCallTarget() const override { return &name; }
+		virtual bool SupportsBatch() const override { return true; } // the batch runner runs the callee itself
+	};
+
+	class YieldInstruction : public Instruction
+	{
+	protected:
+		std::string ticks; // value or var name, number of scheduler updates to wait
+
+	public:
+		YieldInstruction(unsigned int inDebugId, const std::string& inTicks) :
+			Instruction(inDebugId),
+			ticks(inTicks) {}
+
+		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new YieldInstruction(*this); }
+	};
+
+	// 'WaitFor, name' continues once var or register name has a value, right away if it already has one.
+	// 'WaitForNext, name' always waits for the next write to it
+	class WaitForInstruction : public Instruction
+	{
+	protected:
+		std::string name; // parsing should make sure this is not empty and is one word
+		bool nextWrite;
+
+	public:
+		WaitForInstruction(unsigned int inDebugId, const std::string& inName, bool inNextWrite) :
+			Instruction(inDebugId),
+			name(inName),
+			nextWrite(inNextWrite) {}
+
+		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new WaitForInstruction(*this); }
+	};
+
+	class NativeCallInstruction : public Instruction
+	{
+	protected:
+		const NativeFunction* function; // owned by the program's NativeBindings
+		std::string resultName; // var that receives the return value, empty if function returns void or the result is a register
+		bool resultIsRegister; // numeric return goes straight to resultSlot, never through text
+		unsigned int resultSlot;
+		std::vector<NativeArg> args; // parsing should make sure there are function->GetArgCount() of these
+
+	public:
+		NativeCallInstruction(unsigned int inDebugId, const NativeFunction* inFunction, const std::string& inResultName, bool inResultIsRegister, unsigned int inResultSlot, const std::vector<NativeArg>& inArgs) :
+			Instruction(inDebugId),
+			function(inFunction),
+			resultName(inResultName),
+			resultIsRegister(inResultIsRegister),
+			resultSlot(inResultSlot),
+			args(inArgs) {}
+
+		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new NativeCallInstruction(*this); }
 	};
 
 	class Conditional : public Instruction
 	{
+	protected:
+		unsigned int line = 0; // source line for traced branches, so tracing doesn't read the DebugInfo a background compile appends to
+
 	public:
-		Conditional(const std::string& inSrc) : Instruction(inSrc) {}
+		Conditional(unsigned int inDebugId) : Instruction(inDebugId) {}
 		virtual bool IsConditional() const override { return true; }
+
+		unsigned int GetLine() const { return line; }
+		void SetLine(unsigned int inLine) { line = inLine; } // set by parsing
+	};
+
+	enum ECompareOp
+	{
+		Greater,
+		GreaterEqual,
+		Less,
+		LessEqual,
+		Equal,
+		NotEqual
 	};
 
-	class IsGreaterConditional : public Conditional
+	inline bool Compare(const ECompareOp op, const double lVal, const double rVal)
+	{
+		switch (op)
+		{
+		case ECompareOp::Greater: return lVal > rVal;
+		case ECompareOp::GreaterEqual: return lVal >= rVal;
+		case ECompareOp::Less: return lVal < rVal;
+		case ECompareOp::LessEqual: return lVal <= rVal;
+		case ECompareOp::Equal: return lVal == rVal;
+		case ECompareOp::NotEqual: return lVal != rVal;
+		}
+		return false;
+	}
+
+	// compares string vars, converting their values to numbers when run
+	class CompareConditional : public Conditional
 	{
 	protected:
+		ECompareOp op;
 		std::string lVar; // parsing should make sure these are not empty and 1 word
 		std::string rVar;
 
 	public:
-		IsGreaterConditional(const std::string& inSrc, const std::string& inLVar, const std::string& inRVar) :
-			Conditional(inSrc),
+		CompareConditional(unsigned int inDebugId, ECompareOp inOp, const std::string& inLVar, const std::string& inRVar) :
+			Conditional(inDebugId),
+			op(inOp),
 			lVar(inLVar),
 			rVar(inRVar) {}
 
 		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override;
+		virtual Instruction* Clone() const override { return new CompareConditional(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
 	};
 
-	class IsGreaterEqualConditional : public Conditional
+	// number literal or register slot, resolved at parse time
+	struct NumericOperand
+	{
+		bool isRegister = false;
+		unsigned int slot = 0;
+		double constant = 0.0;
+	};
+
+	// compares registers/literals directly, both operands are type checked when parsing
+	class NumericCompareConditional : public Conditional
 	{
 	protected:
-		std::string lVar; // parsing should make sure these are not empty and 1 word
-		std::string rVar;
+		ECompareOp op;
+		NumericOperand lhs;
+		NumericOperand rhs;
 
 	public:
-		IsGreaterEqualConditional(const std::string& inSrc, const std::string& inLVar, const std::string& inRVar) :
-			Conditional(inSrc),
-			lVar(inLVar),
-			rVar(inRVar) {}
+		NumericCompareConditional(unsigned int inDebugId, ECompareOp inOp, const NumericOperand& inLhs, const NumericOperand& inRhs) :
+			Conditional(inDebugId),
+			op(inOp),
+			lhs(inLhs),
+			rhs(inRhs) {}
+
+		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override { return sizeof(*this); }
+		virtual Instruction* Clone() const override { return new NumericCompareConditional(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
+	};
+
+	enum EArithmeticOp
+	{
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Min,
+		Max
+	};
+
+	// dest = lhs op rhs, all registers/literals
+	class ArithmeticInstruction : public Instruction
+	{
+	protected:
+		EArithmeticOp op;
+		unsigned int destSlot;
+		NumericOperand lhs;
+		NumericOperand rhs;
+
+	public:
+		ArithmeticInstruction(unsigned int inDebugId, EArithmeticOp inOp, unsigned int inDestSlot, const NumericOperand& inLhs, const NumericOperand& inRhs) :
+			Instruction(inDebugId),
+			op(inOp),
+			destSlot(inDestSlot),
+			lhs(inLhs),
+			rhs(inRhs) {}
+
+		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override { return sizeof(*this); }
+		virtual Instruction* Clone() const override { return new ArithmeticInstruction(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
+	};
+
+	// SetVar with a register as the target
+	class SetRegisterInstruction : public Instruction
+	{
+	protected:
+		unsigned int destSlot;
+		NumericOperand value;
+
+	public:
+		SetRegisterInstruction(unsigned int inDebugId, unsigned int inDestSlot, const NumericOperand& inValue) :
+			Instruction(inDebugId),
+			destSlot(inDestSlot),
+			value(inValue) {}
 
 		virtual EInstructionResult Execute(Program* context) const override;
+		virtual size_t GetMemorySize() const override { return sizeof(*this); }
+		virtual Instruction* Clone() const override { return new SetRegisterInstruction(*this); }
+		virtual bool SupportsBatch() const override { return true; }
+		virtual void ExecuteBatch(BatchContext& context) const override;
 	};
 }
 
@@ -0,0 +1,66 @@
+#include "native.h"
+
+#include "common/stringUtils.h"
+#include "program.h"
+
+#include <charconv>
+
+namespace cslProgram
+{
+	void PrepareNativeArg(const std::string& word, NumberRegisters& registers, NativeArg& outArg)
+	{
+		outArg.word = word;
+		outArg.isRegister = NumberRegisters::IsRegisterName(word);
+		if (outArg.isRegister)
+		{
+			outArg.slot = registers.GetOrAddSlot(word);
+			return;
+		}
+
+		outArg.isNumber = stringUtils::toNumber(word, outArg.number);
+	}
+
+	bool ResolveNativeNumber(Program* context, const NativeArg& arg, double& outNumber)
+	{
+		if (arg.isRegister)
+		{
+			outNumber = context->GetRegister(arg.slot);
+			return true;
+		}
+
+		const std::string* value = context->FindValue(arg.word);
+		return stringUtils::toNumber(value != nullptr ? *value : arg.word, outNumber);
+	}
+
+	void ResolveNativeString(Program* context, const NativeArg& arg, std::string& outString)
+	{
+		if (arg.isRegister)
+		{
+			stringUtils::fromNumber(context->GetRegister(arg.slot), outString);
+			return;
+		}
+
+		outString = arg.word;
+		context->GetValueFromValueOrName(outString);
+	}
+
+	void NativeToString(const NativeValue& value, std::string& outString)
+	{
+		switch (value.kind)
+		{
+		case NativeValue::Number:
+			stringUtils::fromNumber(value.number, outString);
+			break;
+		case NativeValue::Integer:
+		{
+			char buffer[32];
+			std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value.integer);
+			outString.assign(buffer, result.ptr);
+			break;
+		}
+		case NativeValue::Text:
+			outString = value.text;
+			break;
+		}
+	}
+}
\ No newline at end of file
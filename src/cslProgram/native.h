@@ -0,0 +1,237 @@
+#pragma once
+
+#ifndef CSLPROGRAM_NATIVE_H
+#define CSLPROGRAM_NATIVE_H
+
+#include "registers.h"
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace cslProgram
+{
+	class Program;
+
+	// One argument of a native call, prepared at parse time
+	struct NativeArg
+	{
+		std::string word; // var name or literal, as written in the script
+		bool isNumber = false; // word is a numeric literal, already converted into number
+		double number = 0.0;
+		bool isRegister = false; // word is a register, read by slot
+		unsigned int slot = 0;
+	};
+
+	// Return value of a native call, kept typed until the instruction knows whether it goes to a register or a var
+	struct NativeValue
+	{
+		enum EKind : unsigned char
+		{
+			Number,
+			Integer, // integral and bool returns, formatted without a fraction
+			Text
+		};
+
+		EKind kind = Number;
+		double number = 0.0;
+		long long integer = 0;
+		std::string text;
+
+		double ToNumber() const { return kind == Integer ? static_cast<double>(integer) : number; } // not for Text
+	};
+
+	#pragma region Conversion helpers
+
+	// parse time, converts numeric literals and resolves register slots once so calls don't have to
+	void PrepareNativeArg(const std::string& word, NumberRegisters& registers, NativeArg& outArg);
+
+	// runtime conversion for arguments that were not numeric literals. Return false if value is not a number
+	bool ResolveNativeNumber(Program* context, const NativeArg& arg, double& outNumber);
+	void ResolveNativeString(Program* context, const NativeArg& arg, std::string& outString);
+
+	// only called when the result goes to a string var
+	void NativeToString(const NativeValue& value, std::string& outString);
+
+	// false if number is NaN or out of T's range, where converting it would be undefined
+	template<typename T>
+	bool FitsNativeArg(double number)
+	{
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			return std::isnan(number) == false;
+		}
+		else if constexpr (std::is_integral_v<T>)
+		{
+			const double upper = std::ldexp(1.0, std::numeric_limits<T>::digits);
+			return (std::is_signed_v<T> ? number >= -upper : number > -1.0) && number < upper; // fractions are truncated
+		}
+		else if constexpr (std::is_same_v<T, float>)
+		{
+			return std::isnan(number) == false && (std::isinf(number) || std::fabs(number) <= std::numeric_limits<float>::max());
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	template<typename T>
+	bool ConvertNativeArg(Program* context, const NativeArg& arg, T& outValue)
+	{
+		if constexpr (std::is_same_v<T, std::string>)
+		{
+			ResolveNativeString(context, arg, outValue);
+			return true;
+		}
+		else
+		{
+			static_assert(std::is_arithmetic_v<T>, "Native arguments must be arithmetic types or std::string");
+
+			double number = arg.number;
+			if ((arg.isNumber == false && ResolveNativeNumber(context, arg, number) == false) || FitsNativeArg<T>(number) == false)
+			{
+				return false;
+			}
+
+			outValue = static_cast<T>(number);
+			return true;
+		}
+	}
+
+	template<typename T>
+	void ConvertNativeReturn(T&& value, NativeValue& outValue)
+	{
+		typedef std::decay_t<T> Type;
+		if constexpr (std::is_same_v<Type, std::string>)
+		{
+			outValue.kind = NativeValue::Text;
+			outValue.text = std::forward<T>(value);
+		}
+		else if constexpr (std::is_floating_point_v<Type>)
+		{
+			outValue.kind = NativeValue::Number;
+			outValue.number = static_cast<double>(value);
+		}
+		else
+		{
+			static_assert(std::is_integral_v<Type>, "Native return type must be void, arithmetic or std::string");
+			outValue.kind = NativeValue::Integer;
+			outValue.integer = static_cast<long long>(value);
+		}
+	}
+
+	#pragma endregion
+
+	// Type erased native callable: a function pointer, or an object with one operator() such as a lambda,
+	// functor or std::function. Arguments are converted to the parameter types deduced when binding
+	class NativeFunction
+	{
+	private:
+		typedef bool (*InvokeFunc)(void*, Program*, const NativeArg*, NativeValue&);
+
+		std::shared_ptr<void> callable; // shared by copies of the bindings, so a stateful callable has one state
+		InvokeFunc invoke;
+		size_t argCount;
+		bool hasReturn;
+		bool returnsText; // std::string return, can't be stored in a register
+
+		template<typename F, typename R, typename... Args, size_t... I>
+		static bool Invoke(void* erased, [[maybe_unused]] Program* context, [[maybe_unused]] const NativeArg* args, [[maybe_unused]] NativeValue& outValue, std::index_sequence<I...>)
+		{
+			std::tuple<std::decay_t<Args>...> values;
+			if ((ConvertNativeArg(context, args[I], std::get<I>(values)) && ...) == false)
+			{
+				return false;
+			}
+
+			F& typedCallable = *static_cast<F*>(erased);
+			if constexpr (std::is_void_v<R>)
+			{
+				typedCallable(std::get<I>(values)...);
+			}
+			else
+			{
+				ConvertNativeReturn(typedCallable(std::get<I>(values)...), outValue);
+			}
+
+			return true;
+		}
+
+		template<typename F, typename R, typename... Args>
+		static bool InvokeAll(void* erased, Program* context, const NativeArg* args, NativeValue& outValue)
+		{
+			return Invoke<F, R, Args...>(erased, context, args, outValue, std::index_sequence_for<Args...>{});
+		}
+
+		// the std::function pointer only carries the deduced signature
+		template<typename F, typename R, typename... Args>
+		NativeFunction(F&& inCallable, std::function<R(Args...)>*) :
+			callable(std::make_shared<std::decay_t<F>>(std::forward<F>(inCallable))),
+			invoke(&InvokeAll<std::decay_t<F>, R, Args...>),
+			argCount(sizeof...(Args)),
+			hasReturn(std::is_void_v<R> == false),
+			returnsText(std::is_same_v<std::decay_t<R>, std::string>)
+		{
+			static_assert(sizeof...(Args) > 0 || std::is_void_v<R> == false, "Natives need an argument or a return value, single word lines are function names");
+		}
+
+	public:
+		template<typename F> requires (std::is_same_v<std::decay_t<F>, NativeFunction> == false)
+		explicit NativeFunction(F&& inCallable) :
+			NativeFunction(std::forward<F>(inCallable), static_cast<decltype(std::function(std::declval<std::decay_t<F>>()))*>(nullptr)) {}
+
+		// args must hold GetArgCount() entries. outValue is only written if HasReturn().
+		// returns false if an argument could not be converted
+		bool Call(Program* context, const NativeArg* args, NativeValue& outValue) const { return invoke(callable.get(), context, args, outValue); }
+
+		size_t GetArgCount() const { return argCount; }
+		bool HasReturn() const { return hasReturn; }
+		bool ReturnsText() const { return returnsText; }
+	};
+
+	// Host functions exposed to scripts as instructions, passed to the Program constructor.
+	// Script syntax is 'Name, args...', or 'Name, RESULT_VAR, args...' if the function returns a value.
+	// Built in instructions take priority over natives with the same name
+	class NativeBindings
+	{
+	private:
+		std::unordered_map<std::string, NativeFunction> natives;
+
+	public:
+		// function pointer or callable object, see NativeFunction. Lambdas can capture the host state they need
+		template<typename F>
+		void Bind(const std::string& name, F&& callable)
+		{
+			natives.insert_or_assign(name, NativeFunction(std::forward<F>(callable)));
+		}
+
+		// member function called on object, which has to outlive every program using the bindings
+		template<typename C, typename R, typename... Args>
+		void Bind(const std::string& name, C* object, R(C::*method)(Args...))
+		{
+			Bind(name, [object, method](Args... args) -> R { return (object->*method)(std::forward<Args>(args)...); });
+		}
+
+		template<typename C, typename R, typename... Args>
+		void Bind(const std::string& name, const C* object, R(C::*method)(Args...) const)
+		{
+			Bind(name, [object, method](Args... args) -> R { return (object->*method)(std::forward<Args>(args)...); });
+		}
+
+		const NativeFunction* Find(const std::string& name) const
+		{
+			std::unordered_map<std::string, NativeFunction>::const_iterator iter = natives.find(name);
+			return iter != natives.end() ? &iter->second : nullptr;
+		}
+	};
+}
+
+#endif
\ No newline at end of file
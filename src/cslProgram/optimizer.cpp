@@ -0,0 +1,252 @@
+#include "program.h"
+
+#include "common/common.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace cslProgram
+{
+	#pragma region Call graph
+
+	// Tarjan's strongly connected components over RunFunc targets.
+	// Components come out callees first, so inlining in that order sees already inlined callees
+	class CallGraphAnalysis
+	{
+	private:
+		const std::unordered_map<std::string, Function*>& functions;
+		std::unordered_map<std::string, unsigned int> index;
+		std::unordered_map<std::string, unsigned int> lowLink;
+		std::vector<std::string> stack;
+		std::unordered_set<std::string> onStack;
+		unsigned int nextIndex = 0;
+
+		void Visit(const std::string& name);
+
+	public:
+		std::vector<std::string> order; // every function, callees before callers
+		std::unordered_set<std::string> recursive; // functions that can end up calling themselves
+
+		CallGraphAnalysis(const std::unordered_map<std::string, Function*>& inFunctions);
+	};
+
+	CallGraphAnalysis::CallGraphAnalysis(const std::unordered_map<std::string, Function*>& inFunctions) :
+		functions(inFunctions)
+	{
+		for (const std::pair<const std::string, Function*>& entry : functions)
+		{
+			if (index.find(entry.first) == index.end())
+			{
+				Visit(entry.first);
+			}
+		}
+	}
+
+	void CallGraphAnalysis::Visit(const std::string& name)
+	{
+		index[name] = nextIndex;
+		lowLink[name] = nextIndex;
+		++nextIndex;
+		stack.push_back(name);
+		onStack.insert(name);
+
+		for (const Instruction* instruction : functions.at(name)->instructions)
+		{
+			const std::string* target = instruction->GetCallTarget();
+			if (target == nullptr || functions.find(*target) == functions.end())
+			{
+				continue; // missing functions are a runtime error, nothing to analyse
+			}
+
+			if (*target == name)
+			{
+				recursive.insert(name);
+			}
+
+			if (index.find(*target) == index.end())
+			{
+				Visit(*target);
+				lowLink[name] = std::min(lowLink[name], lowLink[*target]);
+			}
+			else if (onStack.find(*target) != onStack.end())
+			{
+				lowLink[name] = std::min(lowLink[name], index[*target]);
+			}
+		}
+
+		if (lowLink[name] != index[name])
+		{
+			return;
+		}
+
+		// name is the root of a component, pop it
+		const size_t componentStart = std::find(stack.begin(), stack.end(), name) - stack.begin();
+		const bool isCycle = stack.size() - componentStart > 1;
+		for (size_t i = componentStart; i < stack.size(); ++i)
+		{
+			onStack.erase(stack[i]);
+			order.push_back(stack[i]);
+			if (isCycle)
+			{
+				recursive.insert(stack[i]);
+			}
+		}
+		stack.resize(componentStart);
+	}
+
+	#pragma endregion
+
+	#pragma region Passes
+
+	// replaces RunFunc of small non recursive callees with a copy of their instructions.
+	// A conditional's two instructions must stay single instructions, so calls there only inline 1 instruction callees.
+	// A failing callee fails its RunFunc and so the caller, which is what an inlined failing instruction does,
+	// so callees with instructions that can fail are inlined too. Only the error messages and trace events differ
+	void InlineCalls(const std::string& callerName, Function* caller, const std::unordered_map<std::string, Function*>& functions,
+		const std::unordered_set<std::string>& recursive, size_t inlineThreshold, OptimizeReport& report)
+	{
+		std::list<const Instruction*>& instructions = caller->instructions;
+		unsigned int afterConditional = 0; // instructions left that belong to the last conditional
+
+		std::list<const Instruction*>::iterator iter = instructions.begin();
+		while (iter != instructions.end())
+		{
+			const Instruction* instruction = *iter;
+			const bool isConditionalArm = afterConditional > 0;
+			if (isConditionalArm)
+			{
+				--afterConditional;
+			}
+
+			if (instruction->IsConditional())
+			{
+				afterConditional = 2;
+				++iter;
+				continue;
+			}
+
+			const std::string* target = instruction->GetCallTarget();
+			std::unordered_map<std::string, Function*>::const_iterator callee = target != nullptr ? functions.find(*target) : functions.end();
+			if (callee == functions.end() || recursive.find(*target) != recursive.end())
+			{
+				++iter;
+				continue;
+			}
+
+			const std::list<const Instruction*>& body = callee->second->instructions;
+			const bool fits = isConditionalArm ?
+				body.size() == 1 && body.front()->IsConditional() == false :
+				body.size() <= inlineThreshold;
+			if (fits == false)
+			{
+				++iter;
+				continue;
+			}
+
+			for (const Instruction* calleeInstruction : body)
+			{
+				instructions.insert(iter, calleeInstruction->Clone());
+			}
+
+			report.inlined.push_back({ callerName, *target });
+			PRINTF("Inlined %s into %s\n", target->c_str(), callerName.c_str());
+
+			delete instruction;
+			iter = instructions.erase(iter);
+		}
+	}
+
+	// everything reachable from entryPoints through RunFunc. Every entry point has to exist
+	void FindReachable(const std::vector<std::string>& entryPoints, const std::unordered_map<std::string, Function*>& functions, std::unordered_set<std::string>& reachable)
+	{
+		std::vector<std::string> toVisit = entryPoints;
+
+		while (toVisit.empty() == false)
+		{
+			const std::string name = toVisit.back();
+			toVisit.pop_back();
+
+			if (reachable.insert(name).second == false)
+			{
+				continue;
+			}
+
+			for (const Instruction* instruction : functions.at(name)->instructions)
+			{
+				const std::string* target = instruction->GetCallTarget();
+				if (target != nullptr && functions.find(*target) != functions.end())
+				{
+					toVisit.push_back(*target);
+				}
+			}
+		}
+	}
+
+	#pragma endregion
+
+	OptimizeReport Program::Optimize(const OptimizeOptions& options)
+	{
+		OptimizeReport report;
+		if (m_init == false)
+		{
+			return report;
+		}
+
+		// lazy mode: the whole program pass needs every body
+		StopBackgroundCompile();
+		if (CompileAll() == false)
+		{
+			PRINTF("Optimize skipped: program has compile errors\n");
+			return report;
+		}
+
+		PRINTF("Beginning optimize\n");
+
+		CallGraphAnalysis analysis(functions);
+		for (const std::string& name : analysis.order)
+		{
+			InlineCalls(name, functions.at(name), functions, analysis.recursive, options.inlineThreshold, report);
+		}
+
+		// a mistyped entry point would make the functions only it reaches look dead, so nothing is removed
+		for (const std::string& entryPoint : options.entryPoints)
+		{
+			if (functions.find(entryPoint) == functions.end())
+			{
+				PRINTF("Optimize warning: Entry point %s does not exist, no functions will be removed\n", entryPoint.c_str());
+				report.missingEntryPoints.push_back(entryPoint);
+			}
+		}
+
+		if (options.entryPoints.empty() == false && report.missingEntryPoints.empty())
+		{
+			std::unordered_set<std::string> reachable;
+			FindReachable(options.entryPoints, functions, reachable);
+
+			std::unordered_map<std::string, Function*>::iterator iter = functions.begin();
+			while (iter != functions.end())
+			{
+				if (reachable.find(iter->first) != reachable.end())
+				{
+					++iter;
+					continue;
+				}
+
+				report.removed.push_back(iter->first);
+				PRINTF("Removed unreachable function %s\n", iter->first.c_str());
+
+				for (const Instruction* instruction : iter->second->instructions)
+				{
+					delete instruction;
+				}
+				delete iter->second;
+				iter = functions.erase(iter);
+			}
+
+			RebuildFunctionIndex();
+		}
+
+		PRINTF("Finished optimize: %zu calls inlined, %zu functions removed\n\n\n", report.inlined.size(), report.removed.size());
+		return report;
+	}
+}
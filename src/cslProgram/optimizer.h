@@ -0,0 +1,26 @@
+#pragma once
+
+#ifndef CSLPROGRAM_OPTIMIZER_H
+#define CSLPROGRAM_OPTIMIZER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cslProgram
+{
+	struct OptimizeOptions
+	{
+		std::vector<std::string> entryPoints; // functions the host runs, e.g. ON_START. Empty keeps every function
+		size_t inlineThreshold = 4; // callees with at most this many instructions get inlined
+	};
+
+	struct OptimizeReport
+	{
+		std::vector<std::pair<std::string, std::string>> inlined; // caller, callee. One entry per inlined RunFunc
+		std::vector<std::string> removed; // functions unreachable from the entry points
+		std::vector<std::string> missingEntryPoints; // entry points that don't exist. Nothing is removed if there are any
+	};
+}
+
+#endif
@@ -2,15 +2,19 @@
 
 #include "common/common.h"
 #include "common/stringUtils.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <string_view>
 
 namespace cslProgram
 {
 	#pragma region Typedefs
 
 	typedef std::list<const Instruction*>::const_iterator InstructionIterator;
-	typedef std::unordered_map<std::string, const Function*>::iterator FunctionIterator;
+	typedef std::unordered_map<std::string, Function*>::iterator FunctionIterator;
 	typedef std::unordered_map<std::string, std::string>::iterator VariableIterator;
-	typedef Instruction* (*ExtractInstructionFunc)(const std::vector<std::string>&, const std::string&);
+	typedef Instruction* (*ExtractInstructionFunc)(const std::vector<std::string>&, const std::string&, unsigned int, NumberRegisters&);
 
 	#pragma endregion
 	
@@ -32,6 +36,53 @@ namespace cslProgram
 		return iter;
 	}
 
+	// outside a scheduler there is nothing to wait on, so Yield just continues and a WaitFor that has to wait is an error
+	EInstructionResult ResolveSuspendSync(const Program* context, const EInstructionResult result)
+	{
+		if (result != EInstructionResult::Suspend)
+		{
+			return result;
+		}
+
+		const SuspendRequest& request = context->GetSuspendRequest();
+		if (request.varName.empty())
+		{
+			return EInstructionResult::Success;
+		}
+
+		PRINTF("Runtime Error: WaitFor %s can only run inside a fiber\n", request.varName.c_str());
+		return EInstructionResult::Fail;
+	}
+
+	// co_await'ed by fibers on EInstructionResult::Suspend or running out of budget,
+	// hands the suspended frame to whoever is running the fiber
+	struct SuspendAwaiter
+	{
+		Program* program;
+		bool isPreempted;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) const
+		{
+			program->SuspendFiber(handle, isPreempted);
+		}
+		void await_resume() const noexcept {}
+	};
+
+	// true if word is a register or number literal. Registers get their slot assigned here
+	bool GetNumericOperand(const std::string& word, NumberRegisters& registers, NumericOperand& outOperand)
+	{
+		if (NumberRegisters::IsRegisterName(word))
+		{
+			outOperand.isRegister = true;
+			outOperand.slot = registers.GetOrAddSlot(word);
+			return true;
+		}
+
+		outOperand.isRegister = false;
+		return stringUtils::toNumber(word, outOperand.constant);
+	}
+
 	void DeleteFuncInstructions(const Function* func)
 	{
 		if (func == nullptr) return;
@@ -46,70 +97,221 @@ namespace cslProgram
 
 	#pragma region Instruction Extraction Functions
 
-	Instruction* ExtractPrintInstruction(const std::vector<std::string>& words, const std::string& src)
+	Instruction* ExtractPrintInstruction(const std::vector<std::string>& words, const std::string& /*src*/, unsigned int debugId, NumberRegisters& /*registers*/)
 	{
-		return new PrintInstruction(src, words);
+		return new PrintInstruction(debugId, words);
 	}
 
-	Instruction* ExtractSetVarInstruction(const std::vector<std::string>& words, const std::string& src)
+	Instruction* ExtractSetVarInstruction(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& registers)
 	{
 		if (words.size() != 2)
 		{
-			PRINTF("Expected 2 arguments to SetVar in line: %s\n", src);
+			PRINTF("Expected 2 arguments to SetVar in line: %s\n", src.c_str());
 			return nullptr;
 		}
 		
 		if (stringUtils::hasSpace(words[0]))
 		{
-			PRINTF("Variable name (argument 1) has to be one word: %s\n", src);
+			PRINTF("Variable name (argument 1) has to be one word: %s\n", src.c_str());
 			return nullptr;
 		}
 
-		return new SetVarInstruction(src, words[0], words[1]);
+		if (NumberRegisters::IsRegisterName(words[0]))
+		{
+			NumericOperand value;
+			if (GetNumericOperand(words[1], registers, value) == false)
+			{
+				PRINTF("Compilation error: Register %s can only be set to a number or register: %s\n", words[0].c_str(), src.c_str());
+				return nullptr;
+			}
+
+			return new SetRegisterInstruction(debugId, registers.GetOrAddSlot(words[0]), value);
+		}
+
+		return new SetVarInstruction(debugId, words[0], words[1]);
 	}
 
-	Instruction* ExtractRunFuncInstruction(const std::vector<std::string>& words, const std::string& src)
+	Instruction* ExtractRunFuncInstruction(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& /*registers*/)
 	{
 		if (words.size() != 1)
 		{
-			PRINTF("Expected 1 argument to RunFunc in line: %s\n", src);
+			PRINTF("Expected 1 argument to RunFunc in line: %s\n", src.c_str());
 			return nullptr;
 		}
 
 		if (stringUtils::hasSpace(words[0]))
 		{
-			PRINTF("Function name (argument 1) has to be one word: %s\n", src);
+			PRINTF("Function name (argument 1) has to be one word: %s\n", src.c_str());
 			return nullptr;
 		}
 
-		return new RunFuncInstruction(src, words[0]);
+		return new RunFuncInstruction(debugId, words[0]);
 	}
 
-	Instruction* ExtractIsGreaterConditional(const std::vector<std::string>& words, const std::string& src)
+	const char* const s_compareNames[] = { "IsGreater", "IsGreaterEqual", "IsLess", "IsLessEqual", "IsEqual", "IsNotEqual" };
+
+	// registers compare as numbers directly. Anything else keeps the string var behaviour of converting when run
+	template<ECompareOp Op>
+	Instruction* ExtractCompareConditional(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& registers)
 	{
 		if (words.size() != 2)
 		{
-			PRINTF("Expected 2 arguments to IsGreater in line: %s\n", src);
+			PRINTF("Expected 2 arguments to %s in line: %s\n", s_compareNames[Op], src.c_str());
 			return nullptr;
 		}
 
 		if (stringUtils::hasSpace(words[0]) || stringUtils::hasSpace(words[1]))
 		{
-			PRINTF("Variable names (arguments 1 and 2) have to be one word: %s\n", src);
+			PRINTF("Variable names (arguments 1 and 2) have to be one word: %s\n", src.c_str());
+			return nullptr;
+		}
+
+		NumericOperand lhs;
+		NumericOperand rhs;
+		const bool isLNumeric = GetNumericOperand(words[0], registers, lhs);
+		const bool isRNumeric = GetNumericOperand(words[1], registers, rhs);
+		if (isLNumeric && isRNumeric)
+		{
+			return new NumericCompareConditional(debugId, Op, lhs, rhs);
+		}
+
+		if (lhs.isRegister || rhs.isRegister)
+		{
+			PRINTF("Compilation error: Registers can only be compared with numbers or registers: %s\n", src.c_str());
+			return nullptr;
+		}
+
+		return new CompareConditional(debugId, Op, words[0], words[1]);
+	}
+
+	const char* const s_arithmeticNames[] = { "Add", "Sub", "Mul", "Div", "Min", "Max" };
+
+	// 'Add, #dest, a, b'. Everything has to be a register or number literal
+	template<EArithmeticOp Op>
+	Instruction* ExtractArithmeticInstruction(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& registers)
+	{
+		if (words.size() != 3)
+		{
+			PRINTF("Expected 3 arguments to %s in line: %s\n", s_arithmeticNames[Op], src.c_str());
+			return nullptr;
+		}
+
+		if (NumberRegisters::IsRegisterName(words[0]) == false || stringUtils::hasSpace(words[0]))
+		{
+			PRINTF("Compilation error: Result (argument 1) has to be a #register: %s\n", src.c_str());
+			return nullptr;
+		}
+
+		NumericOperand lhs;
+		NumericOperand rhs;
+		if (GetNumericOperand(words[1], registers, lhs) == false || GetNumericOperand(words[2], registers, rhs) == false)
+		{
+			PRINTF("Compilation error: Arguments 2 and 3 have to be numbers or #registers: %s\n", src.c_str());
+			return nullptr;
+		}
+
+		return new ArithmeticInstruction(debugId, Op, registers.GetOrAddSlot(words[0]), lhs, rhs);
+	}
+
+	Instruction* ExtractYieldInstruction(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& /*registers*/)
+	{
+		if (words.size() != 1)
+		{
+			PRINTF("Expected 1 argument to Yield in line: %s\n", src.c_str());
+			return nullptr;
+		}
+
+		return new YieldInstruction(debugId, words[0]);
+	}
+
+	template<bool NextWrite>
+	Instruction* ExtractWaitForInstruction(const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& /*registers*/)
+	{
+		if (words.size() != 1)
+		{
+			PRINTF("Expected 1 argument to %s in line: %s\n", NextWrite ? "WaitForNext" : "WaitFor", src.c_str());
+			return nullptr;
+		}
+
+		if (stringUtils::hasSpace(words[0]))
+		{
+			PRINTF("Variable name (argument 1) has to be one word: %s\n", src.c_str());
 			return nullptr;
 		}
 
-		return new IsGreaterConditional(src, words[0], words[1]);
+		return new WaitForInstruction(debugId, words[0], NextWrite);
 	}
 
-	const std::unordered_map<std::string, ExtractInstructionFunc> s_extractionInstructionFuncs =
+	// fixed at compile time, so parsing looks up each mnemonic with one hash and one compare
+	constexpr std::pair<std::string_view, ExtractInstructionFunc> s_extractionInstructionEntries[] =
 	{
 		{ "Print", ExtractPrintInstruction },
 		{ "SetVar", ExtractSetVarInstruction },
 		{ "RunFunc", ExtractRunFuncInstruction },
-		{ "IsGreater", ExtractIsGreaterConditional }
+		{ "IsGreater", ExtractCompareConditional<ECompareOp::Greater> },
+		{ "IsGreaterEqual", ExtractCompareConditional<ECompareOp::GreaterEqual> },
+		{ "IsLess", ExtractCompareConditional<ECompareOp::Less> },
+		{ "IsLessEqual", ExtractCompareConditional<ECompareOp::LessEqual> },
+		{ "IsEqual", ExtractCompareConditional<ECompareOp::Equal> },
+		{ "IsNotEqual", ExtractCompareConditional<ECompareOp::NotEqual> },
+		{ "Add", ExtractArithmeticInstruction<EArithmeticOp::Add> },
+		{ "Sub", ExtractArithmeticInstruction<EArithmeticOp::Sub> },
+		{ "Mul", ExtractArithmeticInstruction<EArithmeticOp::Mul> },
+		{ "Div", ExtractArithmeticInstruction<EArithmeticOp::Div> },
+		{ "Min", ExtractArithmeticInstruction<EArithmeticOp::Min> },
+		{ "Max", ExtractArithmeticInstruction<EArithmeticOp::Max> },
+		{ "Yield", ExtractYieldInstruction },
+		{ "WaitFor", ExtractWaitForInstruction<false> },
+		{ "WaitForNext", ExtractWaitForInstruction<true> }
 	};
 
+	constexpr perfectHash::StaticTable<ExtractInstructionFunc, std::size(s_extractionInstructionEntries)> s_extractionInstructionFuncs(s_extractionInstructionEntries);
+
+	// natives are not in s_extractionInstructionFuncs, their argument count comes from the bound function
+	Instruction* ExtractNativeCallInstruction(const NativeFunction* native, const std::string& cmd, const std::vector<std::string>& words, const std::string& src, unsigned int debugId, NumberRegisters& registers)
+	{
+		const size_t resultCount = native->HasReturn() ? 1 : 0;
+		if (words.size() != native->GetArgCount() + resultCount)
+		{
+			PRINTF("Expected %zu arguments to %s in line: %s\n", native->GetArgCount() + resultCount, cmd.c_str(), src.c_str());
+			return nullptr;
+		}
+
+		std::string resultName = "";
+		bool resultIsRegister = false;
+		unsigned int resultSlot = 0;
+		if (resultCount > 0)
+		{
+			resultName = words[0];
+			if (stringUtils::hasSpace(resultName))
+			{
+				PRINTF("Result variable name (argument 1) has to be one word: %s\n", src.c_str());
+				return nullptr;
+			}
+
+			if (NumberRegisters::IsRegisterName(resultName))
+			{
+				if (native->ReturnsText())
+				{
+					PRINTF("Compilation error: %s returns text, it can't be stored in register %s: %s\n", cmd.c_str(), resultName.c_str(), src.c_str());
+					return nullptr;
+				}
+
+				resultIsRegister = true;
+				resultSlot = registers.GetOrAddSlot(resultName);
+				resultName.clear();
+			}
+		}
+
+		std::vector<NativeArg> args(native->GetArgCount());
+		for (size_t i = 0; i < args.size(); ++i)
+		{
+			PrepareNativeArg(words[i + resultCount], registers, args[i]);
+		}
+
+		return new NativeCallInstruction(debugId, native, resultName, resultIsRegister, resultSlot, args);
+	}
+
 	#pragma endregion
 
 	#pragma region Parsing functions
@@ -151,53 +353,46 @@ namespace cslProgram
 		}
 	}
 
-	bool GetNextFunction(std::istream& source, Function*& pFunc, std::string& funcName)
+	// Same answer as IsValidFunctionLine(GetFormattedWords(line)) without allocating, for the lazy mode scan.
+	// line should be trimmed
+	bool IsFunctionHeaderLine(std::string_view line, std::string_view& outName)
 	{
-		assert(pFunc == nullptr);
-
-		std::string rawline;
-
-		bool foundFunc = false; // first find function name, ignore whitespace/empty lines
-		while (std::getline(source, rawline))
+		size_t wordCount = 0;
+		bool hasInnerSpace = false;
+		size_t segmentBegin = 0;
+		while (segmentBegin <= line.size())
 		{
-			PRINTF("Parsing line: %s\n", rawline.c_str());
-			stringUtils::trim(rawline);
-
-			if (rawline.empty())
+			size_t segmentEnd = line.find(',', segmentBegin);
+			if (segmentEnd == std::string_view::npos)
 			{
-				continue;
+				segmentEnd = line.size();
 			}
 
-			std::vector<std::string> words;
-			GetFormattedWords(rawline, words);
-
-			if (IsValidFunctionLine(words))
-			{
-				funcName = words[0];
-				foundFunc = true;
-				break;
-			}
-			else if (IsValidNonFunctionLine(words))
-			{
-				PRINTF("Compilation error: Line outside function: %s\n", rawline.c_str());
-				return false;
-			}
-			else
+			std::string_view segment = line.substr(segmentBegin, segmentEnd - segmentBegin);
+			const size_t first = segment.find_first_not_of(" \t\n\v\f\r");
+			if (first != std::string_view::npos)
 			{
-				PRINTF("Invalid line: %s\n", rawline.c_str());
-				return false;
+				segment = segment.substr(first, segment.find_last_not_of(" \t\n\v\f\r") - first + 1);
+				hasInnerSpace = segment.find_first_of(" \t\n\v\f\r") != std::string_view::npos;
+				outName = segment;
+				if (++wordCount > 1)
+				{
+					return false;
+				}
 			}
-		}
 
-		if (foundFunc == false)
-		{
-			// empty file, so success is true but pFunc is nullptr
-			return true;
+			segmentBegin = segmentEnd + 1;
 		}
 
-		// function name found, now collect all the instructions under it until EOF or next function name
-		Function* newFunction = new Function();
+		return wordCount == 1 && hasInnerSpace == false;
+	}
 
+	// Parses instructions into newFunction until EOF or the next function name, which is left unread.
+	// lineNumber is the number of lines read from source so far, used for debug info
+	// logLines prints every line as it is parsed. Errors are always printed
+	bool ParseFunctionBody(std::istream& source, const NativeBindings& natives, DebugInfo& debugInfo, NumberRegisters& registers, unsigned int& lineNumber, Function* newFunction, bool logLines)
+	{
+		std::string rawline;
 		bool failed = false;
 
 		unsigned int isAfterConditional = 0; // used to catch lack of instructions after conditional (need 2)
@@ -207,7 +402,12 @@ namespace cslProgram
 		std::streampos oldPos = source.tellg(); // used to restore stream seeker when we hit the next function name
 		while (std::getline(source, rawline))
 		{
-			PRINTF("Parsing line: %s\n", rawline.c_str());
+			++lineNumber;
+			if (logLines)
+			{
+				PRINTF("Parsing line: %s\n", rawline.c_str());
+			}
+			const size_t column = rawline.find_first_not_of(" \t\n\v\f\r") + 1;
 			stringUtils::trim(rawline);
 
 			if (rawline.empty())
@@ -222,6 +422,7 @@ namespace cslProgram
 			if (IsValidFunctionLine(words))
 			{
 				source.seekg(oldPos); // reached next function, reset source pos so next read can see this function name
+				--lineNumber;
 				break;
 			}
 
@@ -238,9 +439,15 @@ namespace cslProgram
 			words.erase(words.begin());
 			assert(words.size() > 0);
 
-			if (s_extractionInstructionFuncs.find(cmd) != s_extractionInstructionFuncs.end())
+			const ExtractInstructionFunc* extractFunc = s_extractionInstructionFuncs.find(cmd);
+			const NativeFunction* native = extractFunc != nullptr ? nullptr : natives.Find(cmd); // built in instructions take priority
+
+			if (extractFunc != nullptr || native != nullptr)
 			{
-				Instruction* pNewInstruction = s_extractionInstructionFuncs.at(cmd)(words, rawline);
+				const unsigned int debugId = debugInfo.Add(rawline, lineNumber, static_cast<unsigned int>(column));
+				Instruction* pNewInstruction = native != nullptr ?
+					ExtractNativeCallInstruction(native, cmd, words, rawline, debugId, registers) :
+					(*extractFunc)(words, rawline, debugId, registers);
 				if (pNewInstruction == nullptr)
 				{
 					failed = true;
@@ -249,6 +456,7 @@ namespace cslProgram
 
 				if (pNewInstruction->IsConditional())
 				{
+					static_cast<Conditional*>(pNewInstruction)->SetLine(lineNumber);
 					pLastConditional = pNewInstruction;
 
 					if (isAfterConditional > 0)
@@ -266,7 +474,10 @@ namespace cslProgram
 					--isAfterConditional;
 				}
 
-				PRINTF("Valid Instruction: %s\n", rawline.c_str());
+				if (logLines)
+				{
+					PRINTF("Valid Instruction: %s\n", rawline.c_str());
+				}
 				newFunction->instructions.push_back(pNewInstruction);
 			}
 			else
@@ -279,13 +490,70 @@ namespace cslProgram
 
 		if (isAfterConditional > 0) // there were < 2 instructions after conditional
 		{
-			PRINTF("Compilation error: Not enough instructions after conditional: %s\n", pLastConditional->GetSrcLine());
+			PRINTF("Compilation error: Not enough instructions after conditional: %s\n", debugInfo.GetSrcLine(pLastConditional->GetDebugId()).c_str());
 			failed = true;
 		}
 
 		if (failed)
 		{
 			DeleteFuncInstructions(newFunction);
+			newFunction->instructions.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	// lineNumber is the number of lines read from source so far, used for debug info
+	bool GetNextFunction(std::istream& source, const NativeBindings& natives, DebugInfo& debugInfo, NumberRegisters& registers, unsigned int& lineNumber, Function*& pFunc, std::string& funcName)
+	{
+		assert(pFunc == nullptr);
+
+		std::string rawline;
+
+		bool foundFunc = false; // first find function name, ignore whitespace/empty lines
+		while (std::getline(source, rawline))
+		{
+			++lineNumber;
+			PRINTF("Parsing line: %s\n", rawline.c_str());
+			stringUtils::trim(rawline);
+
+			if (rawline.empty())
+			{
+				continue;
+			}
+
+			std::vector<std::string> words;
+			GetFormattedWords(rawline, words);
+
+			if (IsValidFunctionLine(words))
+			{
+				funcName = words[0];
+				foundFunc = true;
+				break;
+			}
+			else if (IsValidNonFunctionLine(words))
+			{
+				PRINTF("Compilation error: Line outside function: %s\n", rawline.c_str());
+				return false;
+			}
+			else
+			{
+				PRINTF("Invalid line: %s\n", rawline.c_str());
+				return false;
+			}
+		}
+
+		if (foundFunc == false)
+		{
+			// empty file, so success is true but pFunc is nullptr
+			return true;
+		}
+
+		// function name found, now collect all the instructions under it until EOF or next function name
+		Function* newFunction = new Function();
+		if (ParseFunctionBody(source, natives, debugInfo, registers, lineNumber, newFunction, true) == false)
+		{
 			delete newFunction;
 			return false;
 		}
@@ -305,20 +573,26 @@ namespace cslProgram
 		const InstructionIterator end = function->instructions.end();
 
 		EInstructionResult result = EInstructionResult::Success;
+
+		if (m_tracer != nullptr)
+		{
+			m_tracer->Record(ETraceEvent::FunctionEnter, function->traceNameId, 0);
+		}
 		
 		// iterate over instructions
 		while (iter != end)
 		{
-			result = (*iter)->Execute(this);
+			result = ResolveSuspendSync(this, (*iter)->Execute(this));
 
 			if (IsCondResult(result)) // if we just ran a conditional instruction, skip first instruction after this if false, skip second after this if true
 			{
 				const bool isCondTrue = result == EInstructionResult::CondTrue;
+				TraceBranch(*iter, isCondTrue);
 				iter = SafeAdvance(iter, end, isCondTrue ? 1 : 2); // if conditional was true, advance to first instruction after this, if false, skip first and advance to second
 
 				assert(iter != end); // parsing should have caught lack of instructions after conditional
 
-				result = (*iter)->Execute(this);
+				result = ResolveSuspendSync(this, (*iter)->Execute(this));
 
 				assert(IsCondResult(result) == false); // parsing should have caught nested conditional
 
@@ -337,6 +611,11 @@ namespace cslProgram
 			iter = SafeAdvance(iter, end, 1);
 		}
 
+		if (m_tracer != nullptr)
+		{
+			m_tracer->Record(ETraceEvent::FunctionExit, function->traceNameId, result != EInstructionResult::Fail);
+		}
+
 		if (result == EInstructionResult::Fail)
 		{
 			PRINTF("Instruction failed\n");
@@ -346,18 +625,128 @@ namespace cslProgram
 
 		return true;
 	}
+
+	// Fiber Run function, same stepping as RunFunctionInternal but calls and Yield/WaitFor can suspend
+	Fiber Program::RunFiberInternal(const Function* function)
+	{
+		assert(function != nullptr);
+
+		InstructionIterator iter = function->instructions.begin();
+		const InstructionIterator end = function->instructions.end();
+
+		EInstructionResult result = EInstructionResult::Success;
+		unsigned int skipAfter = 0; // 1 while running the first instruction after a true conditional, so the second gets skipped
+
+		// only preemption point. Every loop or runaway chain goes through RunFunc, so checking calls is enough
+		if (m_limited && ConsumeBudget(function) == false)
+		{
+			co_await SuspendAwaiter{ this, true };
+		}
+
+		if (m_tracer != nullptr)
+		{
+			m_tracer->Record(ETraceEvent::FunctionEnter, function->traceNameId, 0);
+		}
+
+		while (iter != end)
+		{
+			const Instruction* instruction = *iter;
+			const std::string* callTarget = instruction->GetCallTarget();
+
+			if (callTarget != nullptr)
+			{
+				// nested calls are fibers too, so they can yield from any depth
+				const Function* callee = FindFunction(*callTarget);
+				result = EInstructionResult::Fail;
+				if (callee != nullptr && EnsureCompiled(callee) && co_await RunFiberInternal(callee))
+				{
+					result = EInstructionResult::Success;
+				}
+				else
+				{
+					PRINTF("Runtime Error: Run function failed at line: %s\n", GetSrcLine(instruction->GetDebugId()).c_str());
+				}
+			}
+			else
+			{
+				result = instruction->Execute(this);
+				if (result == EInstructionResult::Suspend)
+				{
+					co_await SuspendAwaiter{ this, false };
+					result = EInstructionResult::Success;
+				}
+			}
+
+			if (result == EInstructionResult::Fail)
+			{
+				break;
+			}
+
+			if (IsCondResult(result)) // run first instruction after this if true, second if false
+			{
+				assert(skipAfter == 0); // parsing should have caught nested conditional
+
+				const bool isCondTrue = result == EInstructionResult::CondTrue;
+				TraceBranch(instruction, isCondTrue);
+				iter = SafeAdvance(iter, end, isCondTrue ? 1 : 2);
+				skipAfter = isCondTrue ? 1 : 0;
+
+				assert(iter != end); // parsing should have caught lack of instructions after conditional
+				continue;
+			}
+
+			iter = SafeAdvance(iter, end, 1 + skipAfter);
+			skipAfter = 0;
+		}
+
+		if (m_tracer != nullptr)
+		{
+			m_tracer->Record(ETraceEvent::FunctionExit, function->traceNameId, result != EInstructionResult::Fail);
+		}
+
+		if (result == EInstructionResult::Fail)
+		{
+			PRINTF("Instruction failed\n");
+			co_return false;
+		}
+
+		co_return true;
+	}
 	
 	#pragma region Construction Destruction
 
-	Program::Program(std::istream& source)
+	Program::Program(std::istream& source, const NativeBindings& natives, ECompileMode mode) :
+		m_natives(natives)
 	{
 		m_init = false;
+		m_scheduler = nullptr;
+		m_tracer = nullptr;
+		m_limited = false;
+		m_budget = 0;
+		m_hasDeadline = false;
+		m_continuation = nullptr;
+		m_stopCompileThread = false;
+
+		if (mode == ECompileMode::Lazy)
+		{
+			PRINTF("Beginning function scan\n");
+			m_init = ScanFunctions(source);
+			if (m_init == false)
+			{
+				DeleteFunctions();
+			}
+			RebuildFunctionIndex();
+			PRINTF("Finished function scan: %zu functions\n\n\n", functions.size());
+			return;
+		}
+
 		PRINTF("Beginning parse and compile\n");
+		unsigned int lineNumber = 0;
 		while (true)
 		{
 			std::string funcName = "";
 			Function* function = nullptr;
-			bool success = GetNextFunction(source, function, funcName);
+			bool success = GetNextFunction(source, m_natives, m_debugInfo, m_registers, lineNumber, function, funcName);
 			if (success == false)
 			{
 				m_init = false; // there was a 'compile time' error
@@ -374,16 +763,169 @@ namespace cslProgram
 			{
 				m_init = false;
 				DeleteFunctions();
-				PRINTF("Compilation error: Duplicate function name: %s\n", funcName);
+				PRINTF("Compilation error: Duplicate function name: %s\n", funcName.c_str());
 				break;
 			}
 
 			m_init = true;
 			functions.insert({ funcName, function });
 		}
+		RebuildFunctionIndex();
 		PRINTF("Finished parse and compile\n\n\n");
 	}
 
+	void Program::RebuildFunctionIndex()
+	{
+		std::vector<std::pair<std::string_view, Function*>> entries;
+		entries.reserve(functions.size());
+		for (const std::pair<const std::string, Function*>& function : functions)
+		{
+			entries.push_back({ function.first, function.second });
+		}
+
+		m_functionIndex.build(entries);
+	}
+
+	bool Program::ScanFunctions(std::istream& source)
+	{
+		std::ostringstream buffer;
+		buffer << source.rdbuf();
+		m_source = buffer.str();
+
+		std::unordered_map<std::string, unsigned int> callCounts;
+		std::vector<std::string> words;
+		size_t instructionLines = 0;
+		size_t instructionBytes = 0;
+		Function* function = nullptr;
+		unsigned int lineNumber = 0;
+
+		size_t lineBegin = 0;
+		while (lineBegin < m_source.size())
+		{
+			size_t lineEnd = m_source.find('\n', lineBegin);
+			if (lineEnd == std::string::npos)
+			{
+				lineEnd = m_source.size();
+			}
+			++lineNumber;
+
+			std::string_view line(m_source.data() + lineBegin, lineEnd - lineBegin);
+			const size_t first = line.find_first_not_of(" \t\n\v\f\r");
+			if (first != std::string_view::npos)
+			{
+				line = line.substr(first, line.find_last_not_of(" \t\n\v\f\r") - first + 1);
+
+				std::string_view headerName;
+				if (IsFunctionHeaderLine(line, headerName))
+				{
+					if (function != nullptr)
+					{
+						function->sourceEnd = lineBegin;
+					}
+
+					const std::string funcName(headerName);
+					if (functions.find(funcName) != functions.end())
+					{
+						PRINTF("Compilation error: Duplicate function name: %s\n", funcName.c_str());
+						return false;
+					}
+
+					function = new Function();
+					function->sourceBegin = std::min(lineEnd + 1, m_source.size());
+					function->headerLine = lineNumber;
+					function->compileState = ECompileState::NotCompiled;
+					functions.insert({ funcName, function });
+				}
+				else if (function == nullptr)
+				{
+					PRINTF("Compilation error: Line outside function: %s\n", std::string(line).c_str());
+					return false;
+				}
+				else
+				{
+					++instructionLines;
+					instructionBytes += line.size() + 1;
+
+					// registers get their slots now, so compiling later never grows the register table under running code.
+					// RunFunc targets are counted to order background compiles
+					const bool isCall = line.substr(0, 7) == "RunFunc";
+					if (isCall || line.find('#') != std::string_view::npos)
+					{
+						words.clear();
+						GetFormattedWords(std::string(line), words);
+						for (size_t i = 1; i < words.size(); ++i)
+						{
+							if (NumberRegisters::IsRegisterName(words[i]))
+							{
+								m_registers.GetOrAddSlot(words[i]);
+							}
+						}
+
+						if (isCall && words.size() == 2 && words[0] == "RunFunc")
+						{
+							++callCounts[words[1]];
+						}
+					}
+				}
+			}
+
+			lineBegin = lineEnd + 1;
+		}
+
+		if (function != nullptr)
+		{
+			function->sourceEnd = m_source.size();
+		}
+
+		for (const std::pair<const std::string, unsigned int>& callCount : callCounts)
+		{
+			FunctionIterator iter = functions.find(callCount.first);
+			if (iter != functions.end())
+			{
+				iter->second->staticCallCount = callCount.second;
+			}
+		}
+
+		// every body compiled later appends to debug info, reserve once instead of regrowing per function
+		m_debugInfo.Reserve(instructionLines, instructionBytes);
+		return functions.empty() == false;
+	}
+
+	bool Program::EnsureCompiled(const Function* function, bool logLines)
+	{
+		ECompileState state = function->compileState.load(std::memory_order_acquire);
+		if (state != ECompileState::NotCompiled)
+		{
+			return state == ECompileState::Compiled;
+		}
+
+		std::lock_guard<std::mutex> lock(m_compileMutex);
+		state = function->compileState.load(std::memory_order_relaxed);
+		if (state != ECompileState::NotCompiled)
+		{
+			return state == ECompileState::Compiled; // another thread compiled it while we waited
+		}
+
+		// functions are only ever allocated non const by the program, compiling fills in the body
+		Function* body = const_cast<Function*>(function);
+		std::istringstream source(m_source.substr(function->sourceBegin, function->sourceEnd - function->sourceBegin));
+		unsigned int lineNumber = function->headerLine;
+		const bool success = ParseFunctionBody(source, m_natives, m_debugInfo, m_registers, lineNumber, body, logLines);
+
+		body->compileState.store(success ? ECompileState::Compiled : ECompileState::Failed, std::memory_order_release);
+		return success;
+	}
+
+	void Program::StopBackgroundCompile()
+	{
+		if (m_compileThread.joinable())
+		{
+			m_stopCompileThread = true;
+			m_compileThread.join();
+			m_stopCompileThread = false;
+		}
+	}
+
 	void Program::DeleteFunctions()
 	{
 		FunctionIterator iter = functions.begin();
@@ -395,10 +937,14 @@ namespace cslProgram
 		}
 
 		functions.clear();
+		m_functionIndex.clear();
 	}
 
 	Program::~Program()
 	{
+		assert(m_scheduler == nullptr); // scheduler holds fiber frames that point into our functions
+
+		StopBackgroundCompile();
 		DeleteFunctions();
 		variables.clear();
 	}
@@ -407,58 +953,339 @@ namespace cslProgram
 
 	#pragma region Globals/Constants
 
-	const std::unordered_map<std::string, std::string> s_globalVariables =
+	const std::string s_globalValues[] = { " ", "\t" };
+
+	constexpr std::pair<std::string_view, const std::string*> s_globalVariableEntries[] =
 	{
-		{"G_SPACE", " "},
-		{"G_TAB", "\t"}
+		{"G_SPACE", &s_globalValues[0]},
+		{"G_TAB", &s_globalValues[1]}
 	};
 
+	constexpr perfectHash::StaticTable<const std::string*, std::size(s_globalVariableEntries)> s_globalVariables(s_globalVariableEntries);
+
 	#pragma endregion
 
 	#pragma region Public Functions to iteract with program
 
+	const Function* Program::FindFunction(const std::string& functionName) const
+	{
+		Function* const* function = m_functionIndex.find(functionName);
+		return function != nullptr ? *function : nullptr;
+	}
+
 	bool Program::RunFunction(const std::string& functionName)
 	{
-		if (functions.find(functionName) == functions.end())
+		const Function* function = FindFunction(functionName);
+		if (function == nullptr || EnsureCompiled(function) == false)
 		{
 			return false;
 		}
 
-		RunFunctionInternal(functions[functionName]);
-		return true;
+		return RunFunctionInternal(function);
+	}
+
+	const std::string* Program::FindValue(const std::string& name) const
+	{
+		const std::string* const* global = s_globalVariables.find(name);
+		if (global != nullptr)
+		{
+			return *global;
+		}
+
+		std::unordered_map<std::string, std::string>::const_iterator iter = variables.find(name);
+		if (iter != variables.end())
+		{
+			return &iter->second;
+		}
+
+		return nullptr;
+	}
+
+	Continuation Program::RunFunction(const std::string& functionName, const RunLimits& limits)
+	{
+		const Function* function = FindFunction(functionName);
+		if (function == nullptr)
+		{
+			return Continuation(ERunStatus::NotFound);
+		}
+
+		if (EnsureCompiled(function) == false)
+		{
+			return Continuation(ERunStatus::Failed);
+		}
+
+		Continuation continuation(this, RunFiberInternal(function));
+		continuation.Resume(limits);
+		return continuation;
 	}
 
 	bool Program::GetValueFromValueOrName(std::string& valueOrVarName)
 	{
-		if (s_globalVariables.find(valueOrVarName) != s_globalVariables.end())
+		double number;
+		if (GetRegister(valueOrVarName, number))
 		{
-			valueOrVarName = s_globalVariables.at(valueOrVarName);
+			stringUtils::fromNumber(number, valueOrVarName);
 			return true;
 		}
-		if (variables.find(valueOrVarName) != variables.end())
+
+		const std::string* value = FindValue(valueOrVarName);
+		if (value == nullptr)
 		{
-			valueOrVarName = variables.at(valueOrVarName);
-			return true;
+			return false;
 		}
 
-		return false;
+		valueOrVarName = *value;
+		return true;
 	}
 
 	bool Program::GetFloatFromValueOrName(const std::string& valueOrVarName, float& outFloat)
 	{
-		std::string valueString = valueOrVarName;
-		GetValueFromValueOrName(valueString);
-		outFloat = std::stof(valueString);
-		return outFloat != NAN;
+		double number;
+		if (GetRegister(valueOrVarName, number) == false)
+		{
+			const std::string* value = FindValue(valueOrVarName);
+			if (stringUtils::toNumber(value != nullptr ? *value : valueOrVarName, number) == false)
+			{
+				return false;
+			}
+		}
+
+		outFloat = static_cast<float>(number);
+		return true;
 	}
 
 	bool Program::SetVar(const std::string& name, const std::string& inValueOrName)
 	{
 		std::string valueOrVarName = inValueOrName;
 		GetValueFromValueOrName(valueOrVarName);
-		std::pair<VariableIterator, bool> ret = variables.insert_or_assign(name, valueOrVarName);
+		return SetVarValue(name, valueOrVarName);
+	}
+
+	bool Program::SetVarValue(const std::string& name, const std::string& value)
+	{
+		if (NumberRegisters::IsRegisterName(name))
+		{
+			double number;
+			if (stringUtils::toNumber(value, number) == false)
+			{
+				PRINTF("Runtime Error: Register %s can only be set to a number, got: %s\n", name.c_str(), value.c_str());
+				return false;
+			}
+
+			SetRegister(m_registers.GetOrAddSlot(name), number);
+			return true;
+		}
+
+		std::pair<VariableIterator, bool> ret = variables.insert_or_assign(name, value);
+
+		if (m_tracer != nullptr)
+		{
+			m_tracer->RecordVarWrite(name, value);
+		}
+
+		if (m_scheduler != nullptr)
+		{
+			m_scheduler->OnVarSet(name); // wake fibers waiting on this var
+		}
+
 		return ret.first != variables.end();
 	}
 
+	ProgramMemoryStats Program::MemoryStats() const
+	{
+		static const size_t s_smallCapacity = std::string().capacity();
+		const size_t mapNodeOverhead = 2 * sizeof(void*) + sizeof(size_t); // next pointer, bucket slot, cached hash
+		const size_t listNodeOverhead = 2 * sizeof(void*);
+
+		ProgramMemoryStats stats;
+
+		for (const std::pair<const std::string, Function*>& entry : functions)
+		{
+			const Function* function = entry.second;
+
+			++stats.functionCount;
+			stats.functionBytes += sizeof(entry) + mapNodeOverhead + sizeof(Function);
+			stats.functionBytes += entry.first.capacity() > s_smallCapacity ? entry.first.capacity() + 1 : 0;
+
+			if (function->compileState.load(std::memory_order_acquire) != ECompileState::Compiled)
+			{
+				continue; // lazy mode, body not compiled yet
+			}
+
+			stats.instructionCount += function->instructions.size();
+			stats.functionBytes += function->instructions.size() * (sizeof(const Instruction*) + listNodeOverhead);
+
+			for (const Instruction* instruction : function->instructions)
+			{
+				stats.instructionBytes += instruction->GetMemorySize();
+			}
+		}
+		stats.functionBytes += functions.bucket_count() * sizeof(void*);
+		stats.functionBytes += m_functionIndex.getMemoryBytes();
+		stats.functionBytes += m_source.empty() ? 0 : m_source.capacity() + 1;
+
+		stats.debugRecordBytes = m_debugInfo.GetRecordBytes();
+		stats.debugSourceBytes = m_debugInfo.GetSourceBytes();
+
+		for (const std::pair<const std::string, std::string>& entry : variables)
+		{
+			stats.variableBytes += sizeof(entry) + mapNodeOverhead;
+			stats.variableBytes += entry.first.capacity() > s_smallCapacity ? entry.first.capacity() + 1 : 0;
+			stats.variableBytes += entry.second.capacity() > s_smallCapacity ? entry.second.capacity() + 1 : 0;
+		}
+		stats.variableBytes += variables.bucket_count() * sizeof(void*);
+		stats.variableBytes += m_registers.GetMemoryBytes();
+
+		return stats;
+	}
+
+	void Program::SetTracer(Tracer* tracer)
+	{
+		m_tracer = tracer;
+		if (m_tracer == nullptr)
+		{
+			return;
+		}
+
+		// intern names up front so function enter/exit only record an id
+		for (std::pair<const std::string, Function*>& entry : functions)
+		{
+			entry.second->traceNameId = m_tracer->InternName(entry.first);
+		}
+	}
+
+	void Program::StartBackgroundCompile()
+	{
+		if (m_compileThread.joinable())
+		{
+			return;
+		}
+
+		std::vector<const Function*> pending;
+		for (const std::pair<const std::string, Function*>& entry : functions)
+		{
+			if (entry.second->compileState.load(std::memory_order_acquire) == ECompileState::NotCompiled)
+			{
+				pending.push_back(entry.second);
+			}
+		}
+
+		// most called first, then in source order
+		std::sort(pending.begin(), pending.end(), [](const Function* a, const Function* b)
+			{
+				return a->staticCallCount != b->staticCallCount ? a->staticCallCount > b->staticCallCount : a->headerLine < b->headerLine;
+			});
+
+		m_compileThread = std::thread([this, pending]()
+			{
+				for (const Function* function : pending)
+				{
+					if (m_stopCompileThread)
+					{
+						break;
+					}
+					EnsureCompiled(function, false); // line by line logging would interleave with whatever the program prints
+				}
+			});
+	}
+
+	bool Program::CompileAll()
+	{
+		bool success = true;
+		for (const std::pair<const std::string, Function*>& entry : functions)
+		{
+			success = EnsureCompiled(entry.second) && success;
+		}
+		return success;
+	}
+
+	void Program::TraceBranch(const Instruction* conditional, bool isCondTrue) const
+	{
+		if (m_tracer != nullptr)
+		{
+			m_tracer->Record(ETraceEvent::Branch, static_cast<const Conditional*>(conditional)->GetLine(), isCondTrue);
+		}
+	}
+
+	bool Program::GetRegister(const std::string& name, double& outValue) const
+	{
+		unsigned int slot;
+		if (NumberRegisters::IsRegisterName(name) == false || m_registers.FindSlot(name, slot) == false)
+		{
+			return false;
+		}
+
+		outValue = m_registers.Get(slot);
+		return true;
+	}
+
+	void Program::OnRegisterWritten(unsigned int slot)
+	{
+		const std::string& name = m_registers.GetName(slot);
+
+		if (m_tracer != nullptr)
+		{
+			std::string value;
+			stringUtils::fromNumber(m_registers.Get(slot), value);
+			m_tracer->RecordVarWrite(name, value);
+		}
+
+		if (m_scheduler != nullptr)
+		{
+			m_scheduler->OnVarSet(name); // WaitFor works on registers too
+		}
+	}
+
+	void Program::BeginLimitedRun(const RunLimits& limits)
+	{
+		m_budget = limits.instructionBudget > 0 ? limits.instructionBudget : ~0u;
+		m_hasDeadline = limits.timeLimit.count() > 0;
+		if (m_hasDeadline)
+		{
+			m_deadline = std::chrono::steady_clock::now() + limits.timeLimit;
+		}
+		m_limited = limits.instructionBudget > 0 || m_hasDeadline;
+	}
+
+	bool Program::ConsumeBudget(const Function* function)
+	{
+		const unsigned int cost = static_cast<unsigned int>(function->instructions.size()) + 1;
+		if (m_budget < cost || (m_hasDeadline && std::chrono::steady_clock::now() >= m_deadline))
+		{
+			m_budget = 0;
+			return false;
+		}
+
+		m_budget -= cost;
+		return true;
+	}
+
+	void Program::SuspendFiber(std::coroutine_handle<> handle, bool isPreempted)
+	{
+		if (m_continuation != nullptr)
+		{
+			m_continuation->resumePoint = handle;
+			m_continuation->status = isPreempted ? ERunStatus::Preempted : ERunStatus::Suspended;
+			return;
+		}
+
+		assert(m_scheduler != nullptr); // fibers are only run by a scheduler or a continuation
+
+		if (isPreempted)
+		{
+			m_scheduler->SuspendRunning(handle, 1, ""); // back of the queue, carries on next update
+		}
+		else
+		{
+			m_scheduler->SuspendRunning(handle, m_suspendRequest.ticks, m_suspendRequest.varName);
+		}
+	}
+
+	void Program::RequestSuspend(unsigned int ticks, const std::string& varName)
+	{
+		m_suspendRequest.ticks = ticks;
+		m_suspendRequest.varName = varName;
+	}
+
 	#pragma endregion
 }
\ No newline at end of file
@@ -3,42 +3,183 @@
 #ifndef CSLPROGRAM_PROGRAM_H
 #define CSLPROGRAM_PROGRAM_H
 
+#include "batch.h"
+#include "continuation.h"
+#include "debugInfo.h"
+#include "fiber.h"
 #include "instruction.h"
+#include "native.h"
+#include "optimizer.h"
+#include "registers.h"
+#include "trace.h"
 
+#include "common/perfectHash.h"
+
+#include <atomic>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <list>
 
 namespace cslProgram
 {
+	enum class ECompileMode
+	{
+		Eager, // whole script is parsed and validated by the constructor
+		Lazy // constructor only indexes function headers, each body compiles on its first run
+	};
+
+	enum class ECompileState : unsigned char
+	{
+		NotCompiled,
+		Compiled,
+		Failed
+	};
+
 	struct Function
 	{
-		std::list<const Instruction*> instructions;
+		std::list<const Instruction*> instructions; // only valid once compileState is Compiled
+		unsigned int traceNameId = 0; // set by Program::SetTracer
+
+		// lazy mode: body source range in Program::m_source and its first line number
+		size_t sourceBegin = 0;
+		size_t sourceEnd = 0;
+		unsigned int headerLine = 0;
+		unsigned int staticCallCount = 0; // RunFunc lines naming this function, orders background compiles
+		std::atomic<ECompileState> compileState = ECompileState::Compiled;
+	};
+
+	class Scheduler;
+
+	// set by Yield/WaitFor right before they return EInstructionResult::Suspend
+	struct SuspendRequest
+	{
+		unsigned int ticks = 0;
+		std::string varName; // if not empty, wait for this var to be set instead of ticks
+	};
+
+	// Bytes used by a compiled program, see Program::MemoryStats. Container node overhead is estimated
+	struct ProgramMemoryStats
+	{
+		size_t functionCount = 0;
+		size_t instructionCount = 0;
+		size_t functionBytes = 0; // Function objects, their names, instruction lists, the name index and lazy mode source
+		size_t instructionBytes = 0; // Instruction objects and the strings they own
+		size_t debugRecordBytes = 0; // DebugInfo records
+		size_t debugSourceBytes = 0; // DebugInfo source text, 0 if stripped
+		size_t variableBytes = 0; // runtime variables
+
+		size_t GetTotalBytes() const { return functionBytes + instructionBytes + debugRecordBytes + debugSourceBytes + variableBytes; }
 	};
 
 	class Program
 	{
+		friend class Scheduler;
+		friend class Continuation;
+
 	private:
 
-		std::unordered_map<std::string, const Function*> functions; // program instructions stored in functions
+		std::unordered_map<std::string, Function*> functions; // program instructions stored in functions
+		perfectHash::Table<Function*> m_functionIndex; // lookup by name, keys point into functions. Rebuilt when functions change
 		std::unordered_map<std::string, std::string> variables; // program state stored in variables
-		bool m_init; // did program 'compile' when constructed
+		bool m_init; // did program 'compile' when constructed (lazy mode: did the header scan succeed)
+		NativeBindings m_natives; // host functions callable as instructions, fixed at construction
+		DebugInfo m_debugInfo; // source locations of instructions, only read for error messages
+		NumberRegisters m_registers; // numeric '#' registers, slots assigned while parsing
+
+		Scheduler* m_scheduler; // scheduler running this program's fibers, if any
+		SuspendRequest m_suspendRequest;
+		Tracer* m_tracer; // records execution events if not null
+
+		// limits of the current Continuation or Scheduler resume, only checked when entering functions in fibers
+		bool m_limited;
+		unsigned int m_budget;
+		bool m_hasDeadline;
+		std::chrono::steady_clock::time_point m_deadline;
+		Continuation* m_continuation; // continuation being resumed, suspended fibers go to it instead of the scheduler
+
+		// lazy compile mode
+		std::string m_source; // whole script, function bodies are compiled from ranges of it
+		std::mutex m_compileMutex; // one compile at a time, guards m_debugInfo appends
+		std::thread m_compileThread;
+		std::atomic<bool> m_stopCompileThread;
 
 		void DeleteFunctions();
+		void RebuildFunctionIndex();
+		bool ScanFunctions(std::istream& source); // lazy mode load
+		bool EnsureCompiled(const Function* function, bool logLines = true); // false if the body has a compile error
+		void StopBackgroundCompile();
+		const Function* FindFunction(const std::string& functionName) const;
 		bool RunFunctionInternal(const Function* function);
+		void TraceBranch(const Instruction* conditional, bool isCondTrue) const;
+		void OnRegisterWritten(unsigned int slot); // only called while tracing or scheduling
+
+		// same as RunFunctionInternal, but can be suspended by Yield/WaitFor or running out of budget.
+		// Only run by Scheduler and Continuation
+		Fiber RunFiberInternal(const Function* function);
+
+		// batch mode, see RunBatch
+		bool CanRunBatch(const Function* function, std::unordered_set<const Function*>& checked, std::vector<const Instruction*>& outVarSetters);
+		bool CanSetBatchVars(const std::vector<const Instruction*>& varSetters, const BatchColumns& columns);
+		void RunBatchInternal(const Function* function, BatchContext& context, std::vector<unsigned char>& mask, size_t depth);
+		void RunBatchInstruction(const Instruction* instruction, BatchContext& context, std::vector<unsigned char>& mask, size_t depth);
+
+		void BeginLimitedRun(const RunLimits& limits);
+		void EndLimitedRun() { m_limited = false; }
+		bool ConsumeBudget(const Function* function); // false if out of budget or past deadline
 
 	public:
 
-		Program(std::istream& source);
+		Program(std::istream& source, const NativeBindings& natives = NativeBindings(), ECompileMode mode = ECompileMode::Eager);
 		~Program();
 
+		// false if the function doesn't exist or an instruction in it failed. A RunFunc whose callee fails fails too,
+		// so the caller stops there like it does in a fiber or inlined
 		bool RunFunction(const std::string& functionName);
 
+		// Runs the function once for every row of columns, each row seeing its own column values as vars and registers.
+		// Conditionals compute a mask over all rows and both arms run masked, Print output is collected per row.
+		// Vars set by the function become columns, program vars and registers are left untouched.
+		// Returns false without running if the function or one it calls uses Yield, WaitFor or natives.
+		// Batch vars only hold numbers, so it also returns false if a SetVar value isn't a number, register, column,
+		// var set by the batch or program var holding a number. Numbers have to be written the way Print formats them
+		// ("90", not "90.0" or "007"), as would the program value of a var the batch sets, so both runs print the same
+		bool RunBatch(const std::string& functionName, BatchColumns& columns, BatchResult& outResult);
+
+		// Runs until the function finishes, or stops at an instruction boundary when limits run out.
+		// Resume the returned continuation later to carry on, or Cancel it
+		Continuation RunFunction(const std::string& functionName, const RunLimits& limits);
+
 		// Converts to valueOrVarName to value, and sets or creates var 'name'
 		// forwards return value of std::unordered_map insert (should almost always be true)
 		bool SetVar(const std::string& name, const std::string& valueOrVarName);
 
+		// Registers by slot, used by numeric instructions
+		double GetRegister(unsigned int slot) const { return m_registers.Get(slot); }
+		void SetRegister(unsigned int slot, double value)
+		{
+			m_registers.Set(slot, value);
+			if (m_tracer != nullptr || m_scheduler != nullptr)
+			{
+				OnRegisterWritten(slot);
+			}
+		}
+
+		// Registers by name, for host code. Returns false if name is not a register used by the program
+		bool GetRegister(const std::string& name, double& outValue) const;
+		bool FindRegisterSlot(const std::string& name, unsigned int& outSlot) const { return m_registers.FindSlot(name, outSlot); }
+		const std::string& GetRegisterName(unsigned int slot) const { return m_registers.GetName(slot); }
+
+		// Sets or creates var 'name' to value as is, without resolving var names.
+		// Register names ('#name') need a number value
+		bool SetVarValue(const std::string& name, const std::string& value);
+
+		// returns value of global or var 'name', nullptr if there is none
+		const std::string* FindValue(const std::string& name) const;
+
 		// if input string is var name, converts to value of that var.
 		// returns true if input was var and did convert, false if left input unchanged
 		bool GetValueFromValueOrName(std::string& valueOrVarName);
@@ -46,6 +187,32 @@ namespace cslProgram
 		// Converts to value and then converts to float.
 		// returns true if value was a valid float string, false if not a number
 		bool GetFloatFromValueOrName(const std::string& valueOrVarName, float& outFloat);
+
+		// called by Yield/WaitFor instructions before returning EInstructionResult::Suspend
+		void RequestSuspend(unsigned int ticks, const std::string& varName);
+		const SuspendRequest& GetSuspendRequest() const { return m_suspendRequest; }
+
+		// called by a fiber as it suspends, hands its frame to the running Continuation or Scheduler
+		void SuspendFiber(std::coroutine_handle<> handle, bool isPreempted);
+
+		// source line of an instruction, for error messages
+		std::string GetSrcLine(unsigned int debugId) const { return m_debugInfo.GetSrcLine(debugId); }
+
+		ProgramMemoryStats MemoryStats() const;
+
+		// Whole program pass: inlines small RunFunc targets and removes functions unreachable from options.entryPoints.
+		// Call before running anything, removed functions can no longer be run
+		OptimizeReport Optimize(const OptimizeOptions& options);
+
+		// start recording function calls, branches and var writes to tracer. nullptr stops tracing
+		void SetTracer(Tracer* tracer);
+
+		// Lazy mode only: compiles the remaining functions on a background thread, most called first.
+		// Functions run meanwhile still compile on demand, whichever thread gets there first does it
+		void StartBackgroundCompile();
+
+		// compiles every function not compiled yet, returns false if any has a compile error
+		bool CompileAll();
 	};
 }
 
@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef CSLPROGRAM_REGISTERS_H
+#define CSLPROGRAM_REGISTERS_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cslProgram
+{
+	// Typed numeric registers, separate from the string variables.
+	// Register names start with '#'. Each name gets a slot at parse time, so instructions
+	// read and write doubles by index and never convert through strings
+	class NumberRegisters
+	{
+	private:
+		std::unordered_map<std::string, unsigned int> slots;
+		std::vector<std::string> names;
+		std::vector<double> values; // registers start at 0
+
+	public:
+		static bool IsRegisterName(const std::string& word) { return word.size() > 1 && word[0] == '#'; }
+
+		// parse time, name should be a register name
+		unsigned int GetOrAddSlot(const std::string& name)
+		{
+			std::unordered_map<std::string, unsigned int>::iterator iter = slots.find(name);
+			if (iter != slots.end())
+			{
+				return iter->second;
+			}
+
+			const unsigned int slot = static_cast<unsigned int>(values.size());
+			slots.insert({ name, slot });
+			names.push_back(name);
+			values.push_back(0.0);
+			return slot;
+		}
+
+		// returns false if no instruction uses register name
+		bool FindSlot(const std::string& name, unsigned int& outSlot) const
+		{
+			std::unordered_map<std::string, unsigned int>::const_iterator iter = slots.find(name);
+			if (iter == slots.end())
+			{
+				return false;
+			}
+
+			outSlot = iter->second;
+			return true;
+		}
+
+		double Get(unsigned int slot) const { return values[slot]; }
+		void Set(unsigned int slot, double value) { values[slot] = value; }
+		const std::string& GetName(unsigned int slot) const { return names[slot]; }
+
+		size_t GetMemoryBytes() const
+		{
+			size_t size = values.capacity() * sizeof(double) + names.capacity() * sizeof(std::string);
+			size += slots.size() * (sizeof(std::pair<const std::string, unsigned int>) + 3 * sizeof(void*)) + slots.bucket_count() * sizeof(void*);
+			return size;
+		}
+	};
+}
+
+#endif
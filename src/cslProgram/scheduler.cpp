@@ -0,0 +1,131 @@
+#include "scheduler.h"
+
+#include "common/common.h"
+#include "program.h"
+
+namespace cslProgram
+{
+	#pragma region Construction Destruction
+
+	Scheduler::Scheduler(Program& inProgram) :
+		program(inProgram),
+		m_tick(0),
+		m_fiberCount(0),
+		m_running(nullptr)
+	{
+		assert(program.m_scheduler == nullptr);
+		program.m_scheduler = this;
+	}
+
+	Scheduler::~Scheduler()
+	{
+		program.m_scheduler = nullptr;
+
+		// destroying a root fiber frame destroys any nested frames it is awaiting
+		for (FiberEntry* entry : m_ready)
+		{
+			delete entry;
+		}
+
+		while (m_sleeping.empty() == false)
+		{
+			delete m_sleeping.top().entry;
+			m_sleeping.pop();
+		}
+
+		for (std::pair<const std::string, std::vector<FiberEntry*>>& waiters : m_varWaiters)
+		{
+			for (FiberEntry* entry : waiters.second)
+			{
+				delete entry;
+			}
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Public Functions
+
+	bool Scheduler::Spawn(const std::string& functionName)
+	{
+		const Function* function = program.FindFunction(functionName);
+		if (function == nullptr || program.EnsureCompiled(function) == false)
+		{
+			return false;
+		}
+
+		m_ready.push_back(new FiberEntry(program.RunFiberInternal(function)));
+		++m_fiberCount;
+		return true;
+	}
+
+	void Scheduler::Update()
+	{
+		++m_tick;
+
+		while (m_sleeping.empty() == false && m_sleeping.top().wakeTick <= m_tick)
+		{
+			m_ready.push_back(m_sleeping.top().entry);
+			m_sleeping.pop();
+		}
+
+		// fibers woken while running this batch wait for next update, so two fibers can't ping-pong forever
+		std::vector<FiberEntry*> batch;
+		batch.swap(m_ready);
+
+		for (FiberEntry* entry : batch)
+		{
+			Resume(entry);
+		}
+	}
+
+	void Scheduler::SuspendRunning(std::coroutine_handle<> resumePoint, unsigned int ticks, const std::string& varName)
+	{
+		assert(m_running != nullptr); // only fibers started by this scheduler can suspend
+
+		m_running->resumePoint = resumePoint;
+
+		if (varName.empty() == false)
+		{
+			m_varWaiters[varName].push_back(m_running);
+		}
+		else
+		{
+			m_sleeping.push({ m_tick + (ticks > 0 ? ticks : 1), m_running });
+		}
+	}
+
+	void Scheduler::OnVarSet(const std::string& name)
+	{
+		std::unordered_map<std::string, std::vector<FiberEntry*>>::iterator iter = m_varWaiters.find(name);
+		if (iter == m_varWaiters.end())
+		{
+			return;
+		}
+
+		m_ready.insert(m_ready.end(), iter->second.begin(), iter->second.end());
+		m_varWaiters.erase(iter);
+	}
+
+	#pragma endregion
+
+	void Scheduler::Resume(FiberEntry* entry)
+	{
+		m_running = entry;
+		program.BeginLimitedRun(m_limits);
+		entry->resumePoint.resume(); // runs until the fiber finishes or calls SuspendRunning
+		program.EndLimitedRun();
+		m_running = nullptr;
+
+		if (entry->fiber.IsDone())
+		{
+			if (entry->fiber.GetResult() == false)
+			{
+				PRINTF("Runtime Error: Fiber failed\n");
+			}
+
+			delete entry;
+			--m_fiberCount;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef CSLPROGRAM_SCHEDULER_H
+#define CSLPROGRAM_SCHEDULER_H
+
+#include "continuation.h"
+#include "fiber.h"
+
+#include <coroutine>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cslProgram
+{
+	class Program;
+
+	// Single threaded cooperative scheduler for script fibers.
+	// Fibers run until they finish or hit Yield/WaitFor, then get resumed by Update.
+	class Scheduler
+	{
+	private:
+		struct FiberEntry
+		{
+			Fiber fiber; // root fiber, owns the whole chain of nested function frames
+			std::coroutine_handle<> resumePoint; // innermost suspended frame
+
+			FiberEntry(Fiber&& inFiber) : fiber(std::move(inFiber)), resumePoint(fiber.GetHandle()) {}
+		};
+
+		struct TimedEntry
+		{
+			unsigned long long wakeTick;
+			FiberEntry* entry;
+
+			bool operator>(const TimedEntry& other) const { return wakeTick > other.wakeTick; }
+		};
+
+		Program& program;
+		unsigned long long m_tick; // number of Update calls so far
+		size_t m_fiberCount;
+		FiberEntry* m_running; // fiber currently being resumed, null outside of Update
+		RunLimits m_limits; // applied to each fiber every time it is resumed
+
+		std::vector<FiberEntry*> m_ready; // resumed on next Update
+		std::priority_queue<TimedEntry, std::vector<TimedEntry>, std::greater<TimedEntry>> m_sleeping; // waiting on Yield
+		std::unordered_map<std::string, std::vector<FiberEntry*>> m_varWaiters; // waiting on WaitFor, keyed by var name
+
+		void Resume(FiberEntry* entry);
+
+	public:
+		// attaches to program so var writes can wake fibers. Only one scheduler per program
+		Scheduler(Program& inProgram);
+		~Scheduler();
+
+		// queues function to start on next Update. Returns false if function does not exist
+		bool Spawn(const std::string& functionName);
+
+		// advances one tick: wakes finished Yields, then resumes every ready fiber once
+		void Update();
+
+		// called by running fibers to suspend themselves. ticks is ignored if varName is not empty
+		void SuspendRunning(std::coroutine_handle<> resumePoint, unsigned int ticks, const std::string& varName);
+
+		// called by program when a variable is written, makes fibers waiting on it ready
+		void OnVarSet(const std::string& name);
+
+		// fibers that use up their limits get preempted and continue on the next update
+		void SetRunLimits(const RunLimits& limits) { m_limits = limits; }
+
+		size_t GetFiberCount() const { return m_fiberCount; }
+		unsigned long long GetTick() const { return m_tick; }
+	};
+}
+
+#endif
\ No newline at end of file
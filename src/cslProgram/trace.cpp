@@ -0,0 +1,480 @@
+#include "trace.h"
+
+#include "common/common.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace cslProgram
+{
+	#pragma region File format
+
+	// file is the magic and version, followed by chunks:
+	// events chunk: kind, u32 thread index, u32 total dropped, u32 byte count, raw ring bytes
+	// name chunk: kind, u32 id, u16 length, name
+	const char s_traceMagic[8] = { 'C', 'S', 'L', 'T', 'R', 'A', 'C', 'E' };
+	const unsigned int s_traceVersion = 1;
+	const unsigned char s_eventsChunk = 0;
+	const unsigned char s_nameChunk = 1;
+
+	template<typename T>
+	void WriteRaw(std::ostream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	bool ReadBytes(std::istream& in, void* dest, size_t size)
+	{
+		return static_cast<bool>(in.read(static_cast<char*>(dest), size));
+	}
+
+	template<typename T>
+	bool ReadRaw(std::istream& in, T& value)
+	{
+		return ReadBytes(in, &value, sizeof(T));
+	}
+
+	inline unsigned long long TraceNow()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	#pragma endregion
+
+	#pragma region TraceRing
+
+	TraceRing::TraceRing(size_t capacity, unsigned int inThreadIndex) :
+		data(new unsigned char[capacity]),
+		mask(capacity - 1),
+		head(0),
+		tail(0),
+		dropped(0),
+		threadIndex(inThreadIndex)
+	{
+		assert((capacity & mask) == 0);
+	}
+
+	void TraceRing::CopyIn(unsigned long long pos, const void* src, size_t size)
+	{
+		const size_t offset = static_cast<size_t>(pos & mask);
+		const size_t first = std::min(size, mask + 1 - offset);
+		memcpy(data.get() + offset, src, first);
+		memcpy(data.get(), static_cast<const unsigned char*>(src) + first, size - first);
+	}
+
+	void TraceRing::Write(const TraceEventHeader& header, const void* payload)
+	{
+		const size_t size = sizeof(TraceEventHeader) + header.payloadSize;
+		const unsigned long long writePos = head.load(std::memory_order_relaxed);
+
+		if (writePos + size - tail.load(std::memory_order_acquire) > mask + 1)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed); // never block the script thread
+			return;
+		}
+
+		CopyIn(writePos, &header, sizeof(TraceEventHeader));
+		if (header.payloadSize > 0)
+		{
+			CopyIn(writePos + sizeof(TraceEventHeader), payload, header.payloadSize);
+		}
+
+		head.store(writePos + size, std::memory_order_release); // publish whole event at once
+	}
+
+	void TraceRing::Drain(std::vector<unsigned char>& out)
+	{
+		const unsigned long long writePos = head.load(std::memory_order_acquire);
+		const unsigned long long readPos = tail.load(std::memory_order_relaxed);
+		const size_t size = static_cast<size_t>(writePos - readPos);
+
+		const size_t offset = static_cast<size_t>(readPos & mask);
+		const size_t first = std::min(size, mask + 1 - offset);
+		out.insert(out.end(), data.get() + offset, data.get() + offset + first);
+		out.insert(out.end(), data.get(), data.get() + (size - first));
+
+		tail.store(writePos, std::memory_order_release);
+	}
+
+	#pragma endregion
+
+	#pragma region Tracer
+
+	std::atomic<unsigned long long> s_nextTracerSerial(1);
+
+	struct ThreadRingCache
+	{
+		unsigned long long serial = 0;
+		TraceRing* ring = nullptr;
+	};
+
+	thread_local ThreadRingCache t_ringCache;
+
+	Tracer::Tracer(const std::string& path, size_t inRingBytes) :
+		serial(s_nextTracerSerial.fetch_add(1)),
+		ringBytes(std::max<size_t>(std::bit_ceil(inRingBytes), 4096)),
+		file(path, std::ios::binary | std::ios::trunc),
+		isOpen(file.is_open()),
+		namesWritten(0),
+		stopping(false)
+	{
+		if (isOpen == false)
+		{
+			PRINTF("Trace Error: Could not open trace file: %s\n", path.c_str());
+			return;
+		}
+
+		file.write(s_traceMagic, sizeof(s_traceMagic));
+		WriteRaw(file, s_traceVersion);
+
+		flushThread = std::thread(&Tracer::FlushLoop, this);
+	}
+
+	Tracer::~Tracer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			stopping = true;
+		}
+		flushCondition.notify_one();
+
+		if (flushThread.joinable())
+		{
+			flushThread.join();
+		}
+
+		if (isOpen)
+		{
+			Flush(); // anything written after the last periodic flush
+		}
+	}
+
+	TraceRing* Tracer::GetThreadRing()
+	{
+		if (t_ringCache.serial == serial)
+		{
+			return t_ringCache.ring;
+		}
+
+		// first event from this thread, or thread switched tracers
+		std::lock_guard<std::mutex> lock(ringsMutex);
+
+		std::unordered_map<std::thread::id, TraceRing*>::iterator iter = ringsByThread.find(std::this_thread::get_id());
+		TraceRing* ring = nullptr;
+		if (iter != ringsByThread.end())
+		{
+			ring = iter->second;
+		}
+		else
+		{
+			rings.push_back(std::make_unique<TraceRing>(ringBytes, static_cast<unsigned int>(rings.size())));
+			ring = rings.back().get();
+			ringsByThread.insert({ std::this_thread::get_id(), ring });
+		}
+
+		t_ringCache.serial = serial;
+		t_ringCache.ring = ring;
+		return ring;
+	}
+
+	unsigned int Tracer::InternName(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(namesMutex);
+
+		std::unordered_map<std::string, unsigned int>::iterator iter = nameIds.find(name);
+		if (iter != nameIds.end())
+		{
+			return iter->second;
+		}
+
+		const unsigned int id = static_cast<unsigned int>(names.size());
+		names.push_back(name);
+		nameIds.insert({ name, id });
+		return id;
+	}
+
+	void Tracer::Record(ETraceEvent type, unsigned int id, unsigned char flags)
+	{
+		if (isOpen == false) return;
+
+		TraceEventHeader header;
+		header.timestamp = TraceNow();
+		header.id = id;
+		header.payloadSize = 0;
+		header.type = type;
+		header.flags = flags;
+		GetThreadRing()->Write(header, nullptr);
+	}
+
+	void Tracer::RecordVarWrite(const std::string& name, const std::string& value)
+	{
+		if (isOpen == false) return;
+
+		unsigned char payload[256]; // long names/values get truncated, this is for debugging not storage
+		const size_t nameSize = std::min<size_t>(name.size(), 64);
+		const size_t valueSize = std::min<size_t>(value.size(), sizeof(payload) - 1 - nameSize);
+		payload[0] = static_cast<unsigned char>(nameSize);
+		memcpy(payload + 1, name.data(), nameSize);
+		memcpy(payload + 1 + nameSize, value.data(), valueSize);
+
+		TraceEventHeader header;
+		header.timestamp = TraceNow();
+		header.id = 0;
+		header.payloadSize = static_cast<unsigned short>(1 + nameSize + valueSize);
+		header.type = ETraceEvent::VarWrite;
+		header.flags = 0;
+		GetThreadRing()->Write(header, payload);
+	}
+
+	void Tracer::FlushLoop()
+	{
+		std::unique_lock<std::mutex> lock(flushMutex);
+		while (stopping == false)
+		{
+			flushCondition.wait_for(lock, std::chrono::milliseconds(5));
+
+			lock.unlock();
+			Flush();
+			lock.lock();
+		}
+	}
+
+	void Tracer::Flush()
+	{
+		std::vector<TraceRing*> ringsToDrain;
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			for (const std::unique_ptr<TraceRing>& ring : rings)
+			{
+				ringsToDrain.push_back(ring.get());
+			}
+		}
+
+		std::vector<unsigned char> bytes;
+		for (TraceRing* ring : ringsToDrain)
+		{
+			bytes.clear();
+			ring->Drain(bytes);
+			if (bytes.empty())
+			{
+				continue;
+			}
+
+			WriteRaw(file, s_eventsChunk);
+			WriteRaw(file, ring->threadIndex);
+			WriteRaw(file, ring->GetDropped());
+			WriteRaw(file, static_cast<unsigned int>(bytes.size()));
+			file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		}
+
+		// names can be written after the events using them, decoder reads the whole file first
+		std::lock_guard<std::mutex> lock(namesMutex);
+		for (; namesWritten < names.size(); ++namesWritten)
+		{
+			const std::string& name = names[namesWritten];
+			WriteRaw(file, s_nameChunk);
+			WriteRaw(file, static_cast<unsigned int>(namesWritten));
+			WriteRaw(file, static_cast<unsigned short>(name.size()));
+			file.write(name.data(), name.size());
+		}
+
+		file.flush();
+	}
+
+	#pragma endregion
+
+	#pragma region Decoder
+
+	struct DecodedEvent
+	{
+		TraceEventHeader header;
+		unsigned int threadIndex;
+		std::string payload;
+	};
+
+	// log2 buckets of nanoseconds
+	struct LatencyHistogram
+	{
+		unsigned long long count = 0;
+		unsigned long long total = 0;
+		unsigned long long min = ~0ull;
+		unsigned long long max = 0;
+		unsigned long long buckets[64] = {};
+
+		void Add(unsigned long long ns)
+		{
+			++count;
+			total += ns;
+			min = std::min(min, ns);
+			max = std::max(max, ns);
+			++buckets[ns == 0 ? 0 : std::bit_width(ns) - 1];
+		}
+	};
+
+	bool DecodeTrace(std::istream& in, std::ostream& out)
+	{
+		char magic[sizeof(s_traceMagic)];
+		unsigned int version = 0;
+		if (ReadBytes(in, magic, sizeof(magic)) == false || memcmp(magic, s_traceMagic, sizeof(magic)) != 0 || ReadRaw(in, version) == false || version != s_traceVersion)
+		{
+			PRINTF("Trace Error: Not a trace file, or unsupported version\n");
+			return false;
+		}
+
+		std::map<unsigned int, std::vector<unsigned char>> threadBytes;
+		std::map<unsigned int, unsigned int> threadDropped;
+		std::unordered_map<unsigned int, std::string> names;
+
+		unsigned char kind;
+		while (ReadRaw(in, kind))
+		{
+			if (kind == s_eventsChunk)
+			{
+				unsigned int threadIndex, dropped, size;
+				if (ReadRaw(in, threadIndex) == false || ReadRaw(in, dropped) == false || ReadRaw(in, size) == false) return false;
+
+				std::vector<unsigned char>& bytes = threadBytes[threadIndex];
+				const size_t oldSize = bytes.size();
+				bytes.resize(oldSize + size);
+				if (ReadBytes(in, bytes.data() + oldSize, size) == false) return false;
+
+				threadDropped[threadIndex] = dropped;
+			}
+			else if (kind == s_nameChunk)
+			{
+				unsigned int id;
+				unsigned short size;
+				if (ReadRaw(in, id) == false || ReadRaw(in, size) == false) return false;
+
+				std::string name(size, '\0');
+				if (ReadBytes(in, name.data(), size) == false) return false;
+				names[id] = name;
+			}
+			else
+			{
+				PRINTF("Trace Error: Unknown chunk kind %u\n", static_cast<unsigned int>(kind));
+				return false;
+			}
+		}
+
+		std::vector<DecodedEvent> events;
+		for (const std::pair<const unsigned int, std::vector<unsigned char>>& thread : threadBytes)
+		{
+			const std::vector<unsigned char>& bytes = thread.second;
+			size_t pos = 0;
+			while (pos + sizeof(TraceEventHeader) <= bytes.size())
+			{
+				DecodedEvent event;
+				event.threadIndex = thread.first;
+				memcpy(&event.header, bytes.data() + pos, sizeof(TraceEventHeader));
+				pos += sizeof(TraceEventHeader);
+
+				if (pos + event.header.payloadSize > bytes.size()) return false;
+				event.payload.assign(reinterpret_cast<const char*>(bytes.data() + pos), event.header.payloadSize);
+				pos += event.header.payloadSize;
+
+				events.push_back(std::move(event));
+			}
+		}
+
+		std::stable_sort(events.begin(), events.end(), [](const DecodedEvent& a, const DecodedEvent& b)
+			{
+				return a.header.timestamp < b.header.timestamp;
+			});
+
+		std::unordered_map<unsigned int, std::vector<DecodedEvent*>> callStacks; // per thread
+		std::map<std::string, LatencyHistogram> histograms; // per function
+		const unsigned long long start = events.empty() ? 0 : events.front().header.timestamp;
+
+		char line[512];
+		out << "Timeline:\n";
+		for (DecodedEvent& event : events)
+		{
+			std::vector<DecodedEvent*>& stack = callStacks[event.threadIndex];
+			const double time = (event.header.timestamp - start) / 1000.0;
+			const std::string& name = names.count(event.header.id) ? names[event.header.id] : "?";
+
+			switch (event.header.type)
+			{
+			case ETraceEvent::FunctionEnter:
+				snprintf(line, sizeof(line), "[%12.3f us] T%u %*senter %s\n", time, event.threadIndex, static_cast<int>(stack.size() * 2), "", name.c_str());
+				stack.push_back(&event);
+				break;
+
+			case ETraceEvent::FunctionExit:
+			{
+				// match with the nearest enter of the same function, dropped events can leave unmatched ones
+				std::vector<DecodedEvent*>::reverse_iterator enter = std::find_if(stack.rbegin(), stack.rend(), [&event](const DecodedEvent* e)
+					{
+						return e->header.id == event.header.id;
+					});
+
+				unsigned long long duration = 0;
+				if (enter != stack.rend())
+				{
+					duration = event.header.timestamp - (*enter)->header.timestamp;
+					stack.erase(std::next(enter).base(), stack.end());
+					histograms[name].Add(duration);
+				}
+				snprintf(line, sizeof(line), "[%12.3f us] T%u %*sexit %s (%s, %.3f us)\n", time, event.threadIndex, static_cast<int>(stack.size() * 2), "", name.c_str(),
+					event.header.flags ? "ok" : "failed", duration / 1000.0);
+				break;
+			}
+
+			case ETraceEvent::Branch:
+				snprintf(line, sizeof(line), "[%12.3f us] T%u %*sbranch at line %u: %s\n", time, event.threadIndex, static_cast<int>(stack.size() * 2), "", event.header.id,
+					event.header.flags ? "true" : "false");
+				break;
+
+			case ETraceEvent::VarWrite:
+			{
+				const size_t nameSize = event.payload.empty() ? 0 : static_cast<unsigned char>(event.payload[0]);
+				const std::string varName = event.payload.substr(1, nameSize);
+				const std::string value = event.payload.size() > 1 + nameSize ? event.payload.substr(1 + nameSize) : "";
+				snprintf(line, sizeof(line), "[%12.3f us] T%u %*sset %s = %s\n", time, event.threadIndex, static_cast<int>(stack.size() * 2), "", varName.c_str(), value.c_str());
+				break;
+			}
+
+			default:
+				snprintf(line, sizeof(line), "[%12.3f us] T%u unknown event %u\n", time, event.threadIndex, static_cast<unsigned int>(event.header.type));
+				break;
+			}
+
+			out << line;
+		}
+
+		for (const std::pair<const unsigned int, unsigned int>& dropped : threadDropped)
+		{
+			if (dropped.second > 0)
+			{
+				snprintf(line, sizeof(line), "T%u dropped %u events (ring full)\n", dropped.first, dropped.second);
+				out << line;
+			}
+		}
+
+		out << "\nFunction latency:\n";
+		for (const std::pair<const std::string, LatencyHistogram>& entry : histograms)
+		{
+			const LatencyHistogram& histogram = entry.second;
+			snprintf(line, sizeof(line), "%s: count %llu, min %.3f us, avg %.3f us, max %.3f us\n", entry.first.c_str(), histogram.count,
+				histogram.min / 1000.0, histogram.total / 1000.0 / histogram.count, histogram.max / 1000.0);
+			out << line;
+
+			for (unsigned int i = 0; i < 64; ++i)
+			{
+				if (histogram.buckets[i] == 0) continue;
+
+				snprintf(line, sizeof(line), "    [%llu ns, %llu ns): %llu\n", i == 0 ? 0ull : 1ull << i, 2ull << i, histogram.buckets[i]);
+				out << line;
+			}
+		}
+
+		return true;
+	}
+
+	#pragma endregion
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef CSLPROGRAM_TRACE_H
+#define CSLPROGRAM_TRACE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cslProgram
+{
+	enum ETraceEvent : unsigned char
+	{
+		FunctionEnter, // id is function name id
+		FunctionExit, // id is function name id, flags is 1 if function succeeded
+		Branch, // id is source line of the conditional, flags is 1 if it was true
+		VarWrite // payload is name length (1 byte), name, value
+	};
+
+	// Fixed part of every event, followed by payloadSize bytes
+	struct TraceEventHeader
+	{
+		unsigned long long timestamp; // steady_clock nanoseconds
+		unsigned int id;
+		unsigned short payloadSize;
+		unsigned char type; // ETraceEvent
+		unsigned char flags;
+	};
+
+	// Single producer single consumer byte ring, one per traced thread.
+	// The script thread writes whole events, the flush thread drains them. Full ring drops events
+	class TraceRing
+	{
+	private:
+		std::unique_ptr<unsigned char[]> data;
+		const size_t mask; // capacity - 1, capacity is a power of 2
+		std::atomic<unsigned long long> head; // total bytes written, only written by producer
+		std::atomic<unsigned long long> tail; // total bytes read, only written by consumer
+		std::atomic<unsigned int> dropped; // events that didn't fit
+
+		void CopyIn(unsigned long long pos, const void* src, size_t size);
+
+	public:
+		const unsigned int threadIndex;
+
+		TraceRing(size_t capacity, unsigned int inThreadIndex);
+
+		void Write(const TraceEventHeader& header, const void* payload);
+
+		// appends all complete events written so far to out
+		void Drain(std::vector<unsigned char>& out);
+
+		unsigned int GetDropped() const { return dropped.load(std::memory_order_relaxed); }
+	};
+
+	// Optional execution trace recorder, attach with Program::SetTracer.
+	// Events go to per thread rings and are written to the file by a background thread.
+	// Decode the file with DecodeTrace
+	class Tracer
+	{
+	private:
+		const unsigned long long serial; // unique per tracer, so thread local ring caches can't outlive us
+		const size_t ringBytes;
+		std::ofstream file; // only written by flush thread
+		bool isOpen; // copy of file.is_open(), so script threads never touch file
+
+		std::mutex ringsMutex;
+		std::vector<std::unique_ptr<TraceRing>> rings;
+		std::unordered_map<std::thread::id, TraceRing*> ringsByThread;
+
+		std::mutex namesMutex;
+		std::unordered_map<std::string, unsigned int> nameIds;
+		std::vector<std::string> names;
+		size_t namesWritten; // only touched by flush thread
+
+		std::mutex flushMutex;
+		std::condition_variable flushCondition;
+		bool stopping;
+		std::thread flushThread;
+
+		TraceRing* GetThreadRing();
+		void FlushLoop();
+		void Flush(); // only called from flush thread, or destructor after it stopped
+
+	public:
+		// ringBytes is per thread and rounded up to a power of 2
+		Tracer(const std::string& path, size_t inRingBytes = 1 << 20);
+		~Tracer();
+
+		bool IsOpen() const { return isOpen; }
+
+		// ids for names used by events, e.g. function names. Takes a lock, call once per name
+		unsigned int InternName(const std::string& name);
+
+		void Record(ETraceEvent type, unsigned int id, unsigned char flags);
+		void RecordVarWrite(const std::string& name, const std::string& value);
+	};
+
+	// Offline decoder. Writes a readable timeline and per function latency histograms to out
+	bool DecodeTrace(std::istream& in, std::ostream& out);
+}
+
+#endif
\ No newline at end of file
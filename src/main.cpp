@@ -2,21 +2,179 @@
 #include <fstream>
 #include <string>
 #include <list>
+#include <memory>
+#include <sstream>
+#include "common/common.h"
 #include "common/stringUtils.h"
 #include "cslProgram/program.h"
+#include "cslProgram/scheduler.h"
+#include "cslProgram/trace.h"
 
 using namespace std;
 
+// Runs function over rows with RunBatch, then each row on its own with RunFunction, and prints rows where the two differ.
+// Returns the number of rows that differ
+static size_t CheckBatch(cslProgram::Program& program, const string& function, const cslProgram::BatchColumns& input)
+{
+    static const char* const s_names[] = { "X", "Y", "#a", "#b" };
+
+    cslProgram::BatchColumns columns = input;
+    cslProgram::BatchResult result;
+    if (program.RunBatch(function, columns, result) == false)
+    {
+        printf("%s: can't run in batch mode\n", function.c_str());
+        return columns.GetRowCount();
+    }
+
+    size_t mismatches = 0;
+    string value;
+    string captured;
+    for (size_t row = 0; row < columns.GetRowCount(); ++row)
+    {
+        for (const char* name : s_names)
+        {
+            stringUtils::fromNumber(input.FindColumn(name)[row], value);
+            program.SetVarValue(name, value);
+        }
+
+        captured.clear();
+        set_printf_capture(&captured);
+        const bool succeeded = program.RunFunction(function, cslProgram::RunLimits()).GetStatus() == cslProgram::ERunStatus::Finished;
+        set_printf_capture(nullptr);
+
+        // batch output only has what Print wrote
+        string output;
+        istringstream lines(captured);
+        string line;
+        while (getline(lines, line))
+        {
+            if (line.rfind("Runtime Error", 0) != 0 && line != "Instruction failed")
+            {
+                output += line + '\n';
+            }
+        }
+
+        if (succeeded != (result.succeeded[row] != 0) || output != result.output[row])
+        {
+            if (mismatches < 5)
+            {
+                printf("%s row %zu: RunFunction %d [%s] RunBatch %d [%s]\n", function.c_str(), row, succeeded, output.c_str(), result.succeeded[row], result.output[row].c_str());
+            }
+            ++mismatches;
+        }
+    }
+
+    printf("%s: %zu rows, %zu differ\n", function.c_str(), columns.GetRowCount(), mismatches);
+    return mismatches;
+}
+
 int main(int argc, const char* argv[])
 {
+    // cslProto --decode-trace <file> prints a trace recorded with --trace
+    if (argc == 3 && string(argv[1]) == "--decode-trace")
+    {
+        ifstream traceFile(argv[2], ios::binary);
+        return cslProgram::DecodeTrace(traceFile, cout) ? 0 : 1;
+    }
+
     ifstream file("src/script.txt");
 
     if (file.is_open()) {
-        cslProgram::Program program(file);
+        // cslProto --lazy compiles each function on its first run. Optimize needs every body so it's skipped
+        const bool lazy = argc == 2 && string(argv[1]) == "--lazy";
+        cslProgram::Program program(file, cslProgram::NativeBindings(), lazy ? cslProgram::ECompileMode::Lazy : cslProgram::ECompileMode::Eager);
+
+        // cslProto --batch runs ON_PRINT once over a few rows of X and Y
+        if (argc == 2 && string(argv[1]) == "--batch")
+        {
+            cslProgram::BatchColumns columns(4);
+            double* x = columns.AddColumn("X");
+            double* y = columns.AddColumn("Y");
+            for (size_t row = 0; row < columns.GetRowCount(); ++row)
+            {
+                x[row] = 10.0 * row;
+                y[row] = 15.0;
+            }
+
+            cslProgram::BatchResult result;
+            if (program.RunBatch("ON_PRINT", columns, result))
+            {
+                for (size_t row = 0; row < columns.GetRowCount(); ++row)
+                {
+                    printf("row %zu: %s", row, result.output[row].c_str());
+                }
+            }
+            return 0;
+        }
+
+        // cslProto --batch-check runs ON_PRINT and ON_SCORE batched and row by row over every mix of a few edge values,
+        // including equal values, negatives and zero divisors. The row count isn't a multiple of the SIMD width.
+        // ON_SCALE prints a number written in a form batch columns don't keep, and must not run batched
+        if (argc == 2 && string(argv[1]) == "--batch-check")
+        {
+            const double values[] = { -1.5, 0.0, 2.0, 2.5, 15.0, 90.0 };
+            const size_t valueCount = sizeof(values) / sizeof(values[0]);
+
+            cslProgram::BatchColumns columns(valueCount * valueCount * valueCount * valueCount + 3);
+            double* x = columns.AddColumn("X");
+            double* y = columns.AddColumn("Y");
+            double* a = columns.AddColumn("#a");
+            double* b = columns.AddColumn("#b");
+            for (size_t row = 0; row < columns.GetRowCount(); ++row)
+            {
+                x[row] = values[row % valueCount];
+                y[row] = values[row / valueCount % valueCount];
+                a[row] = values[row / (valueCount * valueCount) % valueCount];
+                b[row] = values[row / (valueCount * valueCount * valueCount) % valueCount];
+            }
+
+            size_t mismatches = CheckBatch(program, "ON_PRINT", columns) + CheckBatch(program, "ON_SCORE", columns);
+
+            // ON_SCALE sets a var to 90.0, which a batch column would print as 90, so RunBatch has to refuse it
+            cslProgram::BatchColumns scaleColumns = columns;
+            cslProgram::BatchResult scaleResult;
+            if (program.RunBatch("ON_SCALE", scaleColumns, scaleResult))
+            {
+                printf("ON_SCALE: ran in batch mode, rows print %s instead of 90.0\n", scaleResult.output[0].c_str());
+                ++mismatches;
+            }
+            return mismatches == 0 ? 0 : 1;
+        }
+
+        if (lazy == false)
+        {
+            cslProgram::OptimizeOptions optimizeOptions;
+            optimizeOptions.entryPoints = { "ON_START", "ON_END", "ON_WAIT_FOR_GO" };
+            program.Optimize(optimizeOptions);
+        }
+
+        // cslProto --trace <file> records execution of the script
+        unique_ptr<cslProgram::Tracer> tracer;
+        if (argc == 3 && string(argv[1]) == "--trace")
+        {
+            tracer = make_unique<cslProgram::Tracer>(argv[2]);
+            program.SetTracer(tracer.get());
+        }
 
         program.RunFunction("ON_START");
         program.RunFunction("ON_END");
 
+        {
+            cslProgram::Scheduler scheduler(program);
+            scheduler.Spawn("ON_WAIT_FOR_GO");
+
+            for (int i = 0; i < 3; ++i)
+            {
+                scheduler.Update();
+            }
+
+            program.SetVar("GO", "1");
+            while (scheduler.GetFiberCount() > 0)
+            {
+                scheduler.Update();
+            }
+        }
+
         bool exit = false;
         while (exit == false)
         {